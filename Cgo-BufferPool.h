@@ -0,0 +1,397 @@
+/*************************************************************************
+	> File Name: Cgo-BufferPool.h
+	> Author:Royi
+	> Mail:royi990001@gmail.com
+	> Describe: fixed size, cache aligned receive buffers shared by all
+	            connections, with reference counted slices for handing
+	            received data to thread_pool tasks without a copy
+************************************************************************/
+#ifndef _BUFFER_POOL_H__
+#define _BUFFER_POOL_H__
+
+#include "Cgo-Socket.h"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <string_view>
+#include <vector>
+#include <sys/uio.h>
+
+__NAMESPACE_Cgo_BEGIN__
+
+class buffer_pool;
+
+/*************************************************************************
+* > Struct Name: _pool_block
+* > Describe: header of one pooled buffer, kept apart from the data so
+*             the buffer itself starts on a cache line
+ ************************************************************************/
+struct _pool_block {
+    std::atomic<uint32_t> refs{ 0 };                        // handles sharing the buffer
+    _pool_block *next = nullptr;                            // free list link
+    char *data = nullptr;                                   // buffer_size bytes
+    buffer_pool *pool = nullptr;                            // where it goes back to
+};
+
+/*************************************************************************
+* > Class Name: buffer_slice
+* > Father class: none
+* > Describe: read only view of received bytes that keeps its buffer out
+            of the pool. Copies share the buffer; the last one to go
+            gives it back, from any thread.
+ ************************************************************************/
+class buffer_slice {
+    friend class pooled_buffer;
+
+public:
+
+    buffer_slice() : _block(nullptr), _data(nullptr), _size(0) {}
+
+    buffer_slice(const buffer_slice &other) :
+        _block(other._block), _data(other._data), _size(other._size)
+    {
+        if (_block != nullptr) _block->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    buffer_slice(buffer_slice &&other) noexcept :
+        _block(other._block), _data(other._data), _size(other._size)
+    {
+        other._block = nullptr;
+        other._data = nullptr;
+        other._size = 0;
+    }
+
+    buffer_slice &operator=(buffer_slice other) noexcept {
+        std::swap(_block, other._block);
+        std::swap(_data, other._data);
+        std::swap(_size, other._size);
+        return *this;
+    }
+
+    ~buffer_slice() {
+        this->reset();
+    }
+
+    const char *data() const {
+        return _data;
+    }
+
+    size_t size() const {
+        return _size;
+    }
+
+    bool empty() const {
+        return _size == 0;
+    }
+
+    std::string_view view() const {
+        return std::string_view(_data, _size);
+    }
+
+    /*************************************************************************
+    * > class buffer_slice
+    * > name : sub
+    * > Describe: : len bytes from off, sharing the same buffer
+     ************************************************************************/
+    buffer_slice sub(size_t off, size_t len = (size_t)-1) const {
+        buffer_slice s(*this);
+        off = std::min(off, _size);
+        s._data += off;
+        s._size = std::min(len, _size - off);
+        return s;
+    }
+
+    inline void reset();
+
+private:
+
+    buffer_slice(_pool_block *block, const char *data, size_t size) :
+        _block(block), _data(data), _size(size)
+    {}
+
+    _pool_block *_block;                                    // shared buffer, one reference
+    const char *_data;                                      // first byte of the view
+    size_t _size;                                           // bytes of the view
+};
+
+/*************************************************************************
+* > Class Name: pooled_buffer
+* > Father class: none
+* > Describe: buffer taken from a buffer_pool to receive into, move only.
+            Fill it with recv_from() or by writing to data() and calling
+            commit(), then hand the bytes on as slices. Dropping it with
+            no slice left returns the buffer at once.
+ ************************************************************************/
+class pooled_buffer {
+    friend class buffer_pool;
+
+public:
+
+    pooled_buffer() : _block(nullptr), _capacity(0), _size(0) {}
+
+    pooled_buffer(pooled_buffer &&other) noexcept :
+        _block(other._block), _capacity(other._capacity), _size(other._size)
+    {
+        other._block = nullptr;
+        other._capacity = other._size = 0;
+    }
+
+    pooled_buffer &operator=(pooled_buffer &&other) noexcept {
+        if (this != &other) {
+            this->reset();
+            std::swap(_block, other._block);
+            std::swap(_capacity, other._capacity);
+            std::swap(_size, other._size);
+        }
+        return *this;
+    }
+
+    pooled_buffer(const pooled_buffer &) = delete;
+    pooled_buffer &operator=(const pooled_buffer &) = delete;
+
+    ~pooled_buffer() {
+        this->reset();
+    }
+
+    // false when the pool was at its limit
+    explicit operator bool() const {
+        return _block != nullptr;
+    }
+
+    char *data() {
+        return _block->data;
+    }
+
+    size_t size() const {
+        return _size;
+    }
+
+    size_t capacity() const {
+        return _capacity;
+    }
+
+    size_t available() const {
+        return _capacity - _size;
+    }
+
+    void commit(size_t n) {
+        _size += std::min(n, this->available());
+        return ;
+    }
+
+    /*************************************************************************
+    * > class pooled_buffer
+    * > name : recv_from
+    * > Describe: : one recv from fd into the free space of the buffer
+    * > return : as ::recv, bytes added, 0 at end of stream, -1 with errno
+     ************************************************************************/
+    ::ssize_t recv_from(int fd, int flags = 0) {
+        ::ssize_t n;
+        do {
+            n = ::recv(fd, _block->data + _size, this->available(), flags);
+        } while (n < 0 && errno == EINTR);
+        if (n > 0) _size += (size_t)n;
+        return n;
+    }
+
+    /*************************************************************************
+    * > class pooled_buffer
+    * > name : slice
+    * > Describe: : share len received bytes from off; the buffer stays out
+    *               of the pool until the last slice is gone
+     ************************************************************************/
+    buffer_slice slice(size_t off = 0, size_t len = (size_t)-1) const {
+        off = std::min(off, _size);
+        _block->refs.fetch_add(1, std::memory_order_relaxed);
+        return buffer_slice(_block, _block->data + off, std::min(len, _size - off));
+    }
+
+    inline void reset();
+
+private:
+
+    pooled_buffer(_pool_block *block, size_t capacity) :
+        _block(block), _capacity(capacity), _size(0)
+    {}
+
+    _pool_block *_block;                                    // buffer, one reference
+    size_t _capacity;                                       // bytes of the buffer
+    size_t _size;                                           // bytes filled so far
+};
+
+/*************************************************************************
+* > Class Name: buffer_pool
+* > Father class: none
+* > Describe: fixed size receive buffers carved from 64 byte aligned
+            slabs. A connection takes one only while it reads, and the
+            last slice of the data gives it back, so an idle connection
+            holds no buffer at all. Slabs are kept until the pool dies;
+            regions() lists them for registration with the kernel, e.g.
+            IORING_REGISTER_BUFFERS. Every buffer must be back before
+            the pool is destroyed.
+ ************************************************************************/
+class buffer_pool {
+    using mutex_t = std::mutex;
+
+    friend class buffer_slice;
+    friend class pooled_buffer;
+
+    struct slab_t {
+        char *data;                                         // count buffers
+        _pool_block *blocks;                                // their headers
+        size_t count;                                       // slab_buffers, fewer when max_buffers cut it short
+    };
+
+public:
+
+    static constexpr size_t _align = 64;                   // alignment of every buffer
+
+    /*************************************************************************
+    * > class buffer_pool
+    * > name : constructor
+    * > Describe: : buffer_size is rounded up to the alignment, slabs hold
+    *               slab_buffers buffers each, max_buffers caps the total
+    *               (0 for no cap)
+     ************************************************************************/
+    explicit buffer_pool(size_t buffer_size = 16384, size_t slab_buffers = 64, size_t max_buffers = 0) :
+        _buffer_size((std::max<size_t>(buffer_size, 1) + _align - 1) & ~(_align - 1)),
+        _slab_buffers(std::max<size_t>(slab_buffers, 1)), _max_buffers(max_buffers),
+        _free(nullptr), _total(0), _in_use(0)
+    {}
+
+    buffer_pool(const buffer_pool &) = delete;
+    buffer_pool &operator=(const buffer_pool &) = delete;
+
+    ~buffer_pool() {
+        for (auto &s : _slabs) {
+            ::operator delete(s.data, std::align_val_t(_align));
+            delete[] s.blocks;
+        }
+    }
+
+    /*************************************************************************
+    * > class buffer_pool
+    * > name : acquire
+    * > Describe: : take a buffer, carving a new slab when none is free;
+    *               an empty pooled_buffer when max_buffers are out
+     ************************************************************************/
+    pooled_buffer acquire() {
+        std::unique_lock<std::mutex> locker(m_mutex);
+        if (_free == nullptr && !this->carve()) return pooled_buffer();
+        _pool_block *b = _free;
+        _free = b->next;
+        _in_use += 1;
+        locker.unlock();
+        b->refs.store(1, std::memory_order_relaxed);
+        return pooled_buffer(b, _buffer_size);
+    }
+
+    size_t buffer_size() const {
+        return _buffer_size;
+    }
+
+    // buffers carved so far
+    size_t buffers() {
+        std::unique_lock<std::mutex> locker(m_mutex);
+        return _total;
+    }
+
+    // buffers held by handles right now
+    size_t in_use() {
+        std::unique_lock<std::mutex> locker(m_mutex);
+        return _in_use;
+    }
+
+    // bytes held in slabs, used or free
+    size_t bytes() {
+        std::unique_lock<std::mutex> locker(m_mutex);
+        return _total * (_buffer_size + sizeof(_pool_block));
+    }
+
+    /*************************************************************************
+    * > class buffer_pool
+    * > name : regions
+    * > Describe: : memory of every slab so far, for registering with the
+    *               kernel
+     ************************************************************************/
+    std::vector<struct iovec> regions() {
+        std::unique_lock<std::mutex> locker(m_mutex);
+        std::vector<struct iovec> out;
+        out.reserve(_slabs.size());
+        for (auto &s : _slabs) {
+            struct iovec iov;
+            iov.iov_base = s.data;
+            iov.iov_len = _buffer_size * s.count;
+            out.push_back(iov);
+        }
+        return out;
+    }
+
+private:
+
+    // called with m_mutex held
+    bool carve() {
+        size_t count = _slab_buffers;
+        if (_max_buffers != 0) {
+            if (_total >= _max_buffers) return false;
+            count = std::min(count, _max_buffers - _total);
+        }
+        char *data = static_cast<char *>(::operator new(_buffer_size * count, std::align_val_t(_align)));
+        _pool_block *blocks = new _pool_block[count];
+        _slabs.push_back(slab_t{ data, blocks, count });
+        for (size_t i = count; i-- > 0; ) {
+            blocks[i].data = data + i * _buffer_size;
+            blocks[i].pool = this;
+            blocks[i].next = _free;
+            _free = &blocks[i];
+        }
+        _total += count;
+        return true;
+    }
+
+    // drop one reference, the last one puts the buffer back
+    static void unref(_pool_block *b) {
+        if (b->refs.fetch_sub(1, std::memory_order_acq_rel) != 1) return ;
+        buffer_pool *pool = b->pool;
+        std::unique_lock<std::mutex> locker(pool->m_mutex);
+        b->next = pool->_free;
+        pool->_free = b;
+        pool->_in_use -= 1;
+        return ;
+    }
+
+    const size_t _buffer_size;                              // bytes of one buffer
+    const size_t _slab_buffers;                             // buffers carved at once
+    const size_t _max_buffers;                              // cap on carved buffers, 0 for none
+    mutex_t m_mutex;                                        // mutex for the free list
+    _pool_block *_free;                                     // free buffers
+    std::vector<slab_t> _slabs;                             // every slab carved so far
+    size_t _total;                                          // buffers carved
+    size_t _in_use;                                         // buffers out of the pool
+};
+
+inline void buffer_slice::reset() {
+    if (_block != nullptr) buffer_pool::unref(_block);
+    _block = nullptr;
+    _data = nullptr;
+    _size = 0;
+    return ;
+}
+
+inline void pooled_buffer::reset() {
+    if (_block != nullptr) buffer_pool::unref(_block);
+    _block = nullptr;
+    _capacity = _size = 0;
+    return ;
+}
+
+__NAMESPACE_Cgo_END__
+
+// DATE: 2024-08-03
+// FILENAME: buffer_pool.h
+// AUTHOR: royi
+// END:
+
+#endif
@@ -0,0 +1,598 @@
+/*************************************************************************
+	> File Name: Cgo-ConnPool.h
+	> Author:Royi
+	> Mail:royi990001@gmail.com
+	> Describe: client side pool of keep-alive tcp_ip4 connections, keyed
+	            by peer address, with a per thread cache in front
+************************************************************************/
+#ifndef _CONN_POOL_H__
+#define _CONN_POOL_H__
+
+#include "Cgo-Socket.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <netinet/tcp.h>
+
+__NAMESPACE_Cgo_BEGIN__
+
+/*************************************************************************
+* > Struct Name: conn_pool_options
+* > Describe: limits and timeouts of a conn_pool
+ ************************************************************************/
+struct conn_pool_options {
+    size_t max_per_host = 64;                               // connections per peer in use or shared, before a new connect
+    size_t max_idle_per_host = 16;                          // idle ones kept in the shared list
+    size_t thread_cache = 4;                                // idle ones every thread keeps for itself, at most max_per_host
+    std::chrono::milliseconds idle_timeout{ 30000 };        // idle longer and it is closed
+    std::chrono::milliseconds connect_timeout{ 1000 };      // for connect and for a free slot
+    bool check_on_checkout = true;                          // peek for a closed peer before reuse
+    bool no_delay = true;                                   // TCP_NODELAY on new connections
+};
+
+/*************************************************************************
+* > Struct Name: _conn_host
+* > Describe: pool state of one peer. open counts the connections holding
+*             a slot: in use, being connected, in the shared idle list or
+*             in a thread cache, cached counts the last ones.
+ ************************************************************************/
+struct _conn_host {
+    struct idle_t {
+        int fd;                                             // connection
+        std::chrono::steady_clock::time_point since;        // returned at
+    };
+
+    std::atomic<size_t> open{ 0 };                          // connections holding a slot
+    std::atomic<size_t> cached{ 0 };                        // of those, idle in thread caches
+    std::vector<idle_t> idle;                               // shared idle list, newest last, under the pool mutex
+};
+
+class conn_pool;
+
+/*************************************************************************
+* > Class Name: pooled_connection
+* > Father class: none
+* > Describe: connection checked out of a conn_pool, move only. Going
+            out of scope gives it back for reuse; after an error or a
+            half read response call discard() so it is closed instead.
+ ************************************************************************/
+class pooled_connection {
+    friend class conn_pool;
+
+public:
+
+    pooled_connection() : _fd(-1), _key(0), _reused(false) {}
+
+    pooled_connection(pooled_connection &&other) noexcept :
+        _pool(std::move(other._pool)), _host(std::move(other._host)),
+        _fd(other._fd), _key(other._key), _reused(other._reused)
+    {
+        other._fd = -1;
+    }
+
+    pooled_connection &operator=(pooled_connection &&other) noexcept {
+        if (this != &other) {
+            this->release();
+            _pool = std::move(other._pool);
+            _host = std::move(other._host);
+            _fd = other._fd;
+            _key = other._key;
+            _reused = other._reused;
+            other._fd = -1;
+        }
+        return *this;
+    }
+
+    pooled_connection(const pooled_connection &) = delete;
+    pooled_connection &operator=(const pooled_connection &) = delete;
+
+    ~pooled_connection() {
+        this->release();
+    }
+
+    // false when checkout() failed, errno tells why
+    explicit operator bool() const {
+        return _fd >= 0;
+    }
+
+    int fd() const {
+        return _fd;
+    }
+
+    socket<tcp_ip4> sock() const {
+        return socket<tcp_ip4>(_fd);
+    }
+
+    // came from the pool rather than a new connect
+    bool reused() const {
+        return _reused;
+    }
+
+    inline void release();
+    inline void discard();
+
+private:
+    std::shared_ptr<conn_pool> _pool;                       // keeps the pool alive
+    std::shared_ptr<_conn_host> _host;                      // peer whose slot the connection holds
+    int _fd;                                                // connection, -1 for none
+    uint64_t _key;                                          // peer address and port
+    bool _reused;                                           // taken from an idle list
+};
+
+/*************************************************************************
+* > Class Name: conn_pool
+* > Father class: none
+* > Describe: keep-alive connections to many peers, shared by threads.
+            checkout() first looks in the cache of the calling thread,
+            behind a lock no other thread takes in the common case,
+            then in the shared idle list of the peer, and connects only
+            when both are empty and fewer than max_per_host connections
+            of the peer are open; at the limit it takes one from the
+            cache of another thread or waits up to connect_timeout for
+            a slot, so a thread going quiet never starves the others.
+            Idle connections are checked before reuse and closed after
+            idle_timeout. Create it with make_shared, handles keep it
+            alive.
+ ************************************************************************/
+class conn_pool : public std::enable_shared_from_this<conn_pool> {
+    friend class pooled_connection;
+
+    using clock_t = std::chrono::steady_clock;
+    using mutex_t = std::mutex;
+    using idle_t = _conn_host::idle_t;
+    using host_ptr = std::shared_ptr<_conn_host>;
+
+    struct cached_t {
+        uint64_t key;                                       // peer of the connection
+        host_ptr host;                                      // its pool state
+        idle_t conn;                                        // connection and return time
+    };
+
+    /*************************************************************************
+    * > Struct Name: cache_t
+    * > Describe: idle connections one thread keeps for one pool. Other
+    *             threads only lock it to take a connection at the limit
+    *             or in close(). Given back when the thread ends.
+     ************************************************************************/
+    struct cache_t {
+        std::mutex m_mutex;                                 // mutex for idle
+        std::vector<cached_t> idle;                         // newest last
+    };
+
+    using cache_ptr = std::shared_ptr<cache_t>;
+
+    struct caches_t {
+        struct entry_t {
+            std::weak_ptr<conn_pool> pool;
+            conn_pool *owner;
+            cache_ptr cache;
+        };
+
+        std::vector<entry_t> list;
+
+        ~caches_t() {
+            for (auto &c : list) {
+                // a pool that is gone closed its caches on the way out
+                std::shared_ptr<conn_pool> pool = c.pool.lock();
+                if (pool) pool->retire(c.cache);
+            }
+        }
+    };
+
+public:
+
+    explicit conn_pool(const conn_pool_options &options = conn_pool_options()) :
+        _options(checked(options)), _closed(false), _waiting(0), _connects(0), _reuses(0)
+    {}
+
+    conn_pool(const conn_pool &) = delete;
+    conn_pool &operator=(const conn_pool &) = delete;
+
+    ~conn_pool() {
+        this->close();
+    }
+
+    /*************************************************************************
+    * > class conn_pool
+    * > name : checkout
+    * > Describe: : a connection to addr, reused or new
+    * > return : an empty handle on failure with errno set: ETIMEDOUT when
+    *            no slot freed up in time, else the connect error
+     ************************************************************************/
+    pooled_connection checkout(sockaddr<tcp_ip4> &addr) {
+        uint64_t key = key_of(addr.get_addr());
+        clock_t::time_point now = clock_t::now();
+        cache_t *cache = _closed ? nullptr : this->this_cache(false);
+        cached_t e;
+        while (cache != nullptr && this->take_cached(*cache, key, e)) {
+            if (this->usable(e.conn, now)) return this->hand_out(std::move(e.host), e.conn.fd, key, true);
+            this->drop(*e.host, e.conn.fd);
+        }
+        clock_t::time_point deadline = now + _options.connect_timeout;
+        std::unique_lock<std::mutex> locker(m_mutex);
+        host_ptr host;
+        for (;;) {
+            if (_closed) {
+                errno = ESHUTDOWN;
+                return pooled_connection();
+            }
+            host_ptr &slot = _hosts[key];
+            if (slot == nullptr) slot = std::make_shared<_conn_host>();
+            host = slot;
+            if (!host->idle.empty()) {
+                idle_t e = host->idle.back();
+                host->idle.pop_back();
+                locker.unlock();
+                if (this->usable(e, clock_t::now())) return this->hand_out(std::move(host), e.fd, key, true);
+                this->drop(*host, e.fd);
+                locker.lock();
+                continue;
+            }
+            if (host->open.load() < _options.max_per_host) {
+                host->open.fetch_add(1);
+                break;
+            }
+            if (host->cached.load() > 0 && this->steal(key, e)) {
+                locker.unlock();
+                if (this->usable(e.conn, clock_t::now())) return this->hand_out(std::move(e.host), e.conn.fd, key, true);
+                this->drop(*e.host, e.conn.fd);
+                locker.lock();
+                continue;
+            }
+            // _waiting, open and cached are all seq_cst: either this thread
+            // sees the freed slot or cached connection, or the thread
+            // freeing or caching it sees the waiter
+            _waiting.fetch_add(1);
+            std::cv_status status = std::cv_status::no_timeout;
+            if (host->open.load() >= _options.max_per_host && host->cached.load() == 0) {
+                status = m_cond.wait_until(locker, deadline);
+            }
+            _waiting.fetch_sub(1);
+            if (status == std::cv_status::timeout && clock_t::now() >= deadline) {
+                errno = ETIMEDOUT;
+                return pooled_connection();
+            }
+        }
+        locker.unlock();
+        int fd = this->open(addr);
+        if (fd < 0) {
+            int err = errno;
+            this->free_slot(*host);
+            errno = err;
+            return pooled_connection();
+        }
+        _connects.fetch_add(1, std::memory_order_relaxed);
+        return this->hand_out(std::move(host), fd, key, false);
+    }
+
+    /*************************************************************************
+    * > class conn_pool
+    * > name : evict_idle
+    * > Describe: : close shared idle connections older than idle_timeout;
+    *               thread caches are swept by their own threads
+     ************************************************************************/
+    size_t evict_idle() {
+        clock_t::time_point limit = clock_t::now() - _options.idle_timeout;
+        std::vector<int> stale;
+        {
+            std::unique_lock<std::mutex> locker(m_mutex);
+            for (auto &h : _hosts) {
+                std::vector<idle_t> &idle = h.second->idle;
+                size_t keep = 0;
+                for (size_t i = 0; i < idle.size(); ++i) {
+                    if (idle[i].since < limit) stale.push_back(idle[i].fd);
+                    else idle[keep++] = idle[i];
+                }
+                h.second->open.fetch_sub(idle.size() - keep);
+                idle.resize(keep);
+            }
+        }
+        for (int fd : stale) ::close(fd);
+        if (!stale.empty()) m_cond.notify_all();
+        return stale.size();
+    }
+
+    // connections to addr holding a slot: in use, shared or cached
+    size_t open_to(sockaddr<tcp_ip4> &addr) {
+        std::unique_lock<std::mutex> locker(m_mutex);
+        auto it = _hosts.find(key_of(addr.get_addr()));
+        return it == _hosts.end() ? 0 : it->second->open.load();
+    }
+
+    // new connections made so far
+    uint64_t connects() const {
+        return _connects.load(std::memory_order_relaxed);
+    }
+
+    // checkouts served by an idle connection
+    uint64_t reuses() const {
+        return _reuses.load(std::memory_order_relaxed);
+    }
+
+    /*************************************************************************
+    * > class conn_pool
+    * > name : close
+    * > Describe: : close every idle connection, shared or cached, and
+    *               refuse new checkouts; handles still out are closed on
+    *               return
+     ************************************************************************/
+    void close() {
+        std::unordered_map<uint64_t, host_ptr> hosts;
+        std::vector<cache_ptr> caches;
+        {
+            std::unique_lock<std::mutex> locker(m_mutex);
+            _closed = true;
+            hosts.swap(_hosts);
+            caches.swap(_caches);
+        }
+        for (auto &h : hosts) {
+            for (auto &e : h.second->idle) ::close(e.fd);
+        }
+        for (auto &c : caches) {
+            std::unique_lock<std::mutex> locker(c->m_mutex);
+            for (auto &e : c->idle) ::close(e.conn.fd);
+            c->idle.clear();
+        }
+        m_cond.notify_all();
+        return ;
+    }
+
+private:
+
+    static conn_pool_options checked(conn_pool_options options) {
+        options.thread_cache = std::min(options.thread_cache, options.max_per_host);
+        return options;
+    }
+
+    static uint64_t key_of(const struct ::sockaddr_in &addr) {
+        return ((uint64_t)addr.sin_addr.s_addr << 16) | addr.sin_port;
+    }
+
+    /*************************************************************************
+    * > class conn_pool
+    * > name : this_cache
+    * > Describe: : cache of the calling thread for this pool, created on
+    *               request and registered so close() and waiting checkouts
+    *               reach it. Caches of pools that are gone are dropped
+    *               first, a new pool may live at the same address. A thread
+    *               rarely uses more than one pool, the list is searched
+    *               linearly.
+     ************************************************************************/
+    cache_t *this_cache(bool create) {
+        static thread_local caches_t caches;
+        for (size_t i = caches.list.size(); i-- > 0; ) {
+            // its pool closed it on the way out
+            if (caches.list[i].pool.expired()) caches.list.erase(caches.list.begin() + (long)i);
+        }
+        for (auto &c : caches.list) {
+            if (c.owner == this) return c.cache.get();
+        }
+        if (!create) return nullptr;
+        cache_ptr cache = std::make_shared<cache_t>();
+        {
+            std::unique_lock<std::mutex> locker(m_mutex);
+            if (_closed) return nullptr;
+            _caches.push_back(cache);
+        }
+        caches.list.push_back(caches_t::entry_t{ this->weak_from_this(), this, cache });
+        return cache.get();
+    }
+
+    /*************************************************************************
+    * > class conn_pool
+    * > name : take_cached
+    * > Describe: : move the newest connection to key out of cache into e.
+    *               It keeps its slot.
+     ************************************************************************/
+    bool take_cached(cache_t &cache, uint64_t key, cached_t &e) {
+        std::unique_lock<std::mutex> locker(cache.m_mutex);
+        for (size_t i = cache.idle.size(); i-- > 0; ) {
+            if (cache.idle[i].key != key) continue;
+            e = std::move(cache.idle[i]);
+            cache.idle.erase(cache.idle.begin() + (long)i);
+            e.host->cached.fetch_sub(1);
+            return true;
+        }
+        return false;
+    }
+
+    // a connection to key from any thread cache, under m_mutex
+    bool steal(uint64_t key, cached_t &e) {
+        for (auto &c : _caches) {
+            if (this->take_cached(*c, key, e)) return true;
+        }
+        return false;
+    }
+
+    /*************************************************************************
+    * > class conn_pool
+    * > name : usable
+    * > Describe: : idle connection e is fresh and its peer has not closed
+    *               it nor left unread bytes behind
+     ************************************************************************/
+    bool usable(const idle_t &e, clock_t::time_point now) const {
+        if (now - e.since > _options.idle_timeout) return false;
+        if (!_options.check_on_checkout) return true;
+        char c;
+        ::ssize_t n = ::recv(e.fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+        return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    }
+
+    int open(sockaddr<tcp_ip4> &addr) {
+        socket<tcp_ip4> sock(::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0));
+        if ((int)sock < 0) return -1;
+        if (sock.connect(addr, (int)_options.connect_timeout.count()) < 0) {
+            int err = errno;
+            ::close(sock);
+            errno = err;
+            return -1;
+        }
+        if (_options.no_delay) {
+            int one = 1;
+            ::setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+        return sock;
+    }
+
+    pooled_connection hand_out(host_ptr host, int fd, uint64_t key, bool reused) {
+        if (reused) _reuses.fetch_add(1, std::memory_order_relaxed);
+        pooled_connection conn;
+        conn._pool = this->shared_from_this();
+        conn._host = std::move(host);
+        conn._fd = fd;
+        conn._key = key;
+        conn._reused = reused;
+        return conn;
+    }
+
+    /*************************************************************************
+    * > class conn_pool
+    * > name : free_slot
+    * > Describe: : a slot of host is free again, wake the waiters if any.
+    *               Their cv is shared by all peers, so all of them wake.
+     ************************************************************************/
+    void free_slot(_conn_host &host) {
+        host.open.fetch_sub(1);
+        this->wake_waiting();
+        return ;
+    }
+
+    void wake_waiting() {
+        if (_waiting.load() == 0) return ;
+        std::unique_lock<std::mutex> locker(m_mutex);
+        locker.unlock();
+        m_cond.notify_all();
+        return ;
+    }
+
+    void drop(_conn_host &host, int fd) {
+        ::close(fd);
+        this->free_slot(host);
+        return ;
+    }
+
+    /*************************************************************************
+    * > class conn_pool
+    * > name : give_back
+    * > Describe: : a handle returned fd; the thread cache takes it while
+    *               it has room, then the shared list. Either way it keeps
+    *               its slot.
+     ************************************************************************/
+    void give_back(host_ptr host, uint64_t key, int fd) {
+        clock_t::time_point now = clock_t::now();
+        cache_t *cache = (_options.thread_cache != 0 && !_closed) ? this->this_cache(true) : nullptr;
+        if (cache != nullptr) {
+            std::vector<cached_t> stale;
+            bool cached = false;
+            {
+                std::unique_lock<std::mutex> locker(cache->m_mutex);
+                // sweep what went stale while the thread was busy
+                for (size_t i = cache->idle.size(); i-- > 0; ) {
+                    if (now - cache->idle[i].conn.since <= _options.idle_timeout) continue;
+                    cache->idle[i].host->cached.fetch_sub(1);
+                    stale.push_back(std::move(cache->idle[i]));
+                    cache->idle.erase(cache->idle.begin() + (long)i);
+                }
+                if (cache->idle.size() < _options.thread_cache) {
+                    cache->idle.push_back(cached_t{ key, host, idle_t{ fd, now } });
+                    host->cached.fetch_add(1);
+                    cached = true;
+                }
+                // close() swept the caches before this one was filled
+                if (_closed) {
+                    for (auto &e : cache->idle) e.host->cached.fetch_sub(1);
+                    stale.insert(stale.end(), cache->idle.begin(), cache->idle.end());
+                    cache->idle.clear();
+                }
+            }
+            for (auto &e : stale) this->drop(*e.host, e.conn.fd);
+            if (cached) {
+                this->wake_waiting();
+                return ;
+            }
+        }
+        this->put_shared(*host, idle_t{ fd, now });
+        return ;
+    }
+
+    /*************************************************************************
+    * > class conn_pool
+    * > name : retire
+    * > Describe: : the thread of cache ends, its connections move to the
+    *               shared lists
+     ************************************************************************/
+    void retire(const cache_ptr &cache) {
+        {
+            std::unique_lock<std::mutex> locker(m_mutex);
+            _caches.erase(std::remove(_caches.begin(), _caches.end(), cache), _caches.end());
+        }
+        std::vector<cached_t> idle;
+        {
+            std::unique_lock<std::mutex> locker(cache->m_mutex);
+            idle.swap(cache->idle);
+        }
+        for (auto &e : idle) {
+            e.host->cached.fetch_sub(1);
+            this->put_shared(*e.host, e.conn);
+        }
+        return ;
+    }
+
+    // e holds a slot of host
+    void put_shared(_conn_host &host, const idle_t &e) {
+        {
+            std::unique_lock<std::mutex> locker(m_mutex);
+            if (!_closed && host.idle.size() < _options.max_idle_per_host) {
+                host.idle.push_back(e);
+                bool wake = _waiting.load() > 0;
+                locker.unlock();
+                if (wake) m_cond.notify_all();
+                return ;
+            }
+        }
+        this->drop(host, e.fd);
+        return ;
+    }
+
+    const conn_pool_options _options;
+    mutex_t m_mutex;                                        // mutex for _hosts, idle lists, _caches and _closed
+    std::condition_variable m_cond;                         // a slot or idle connection freed up
+    std::unordered_map<uint64_t, host_ptr> _hosts;          // per peer state
+    std::vector<cache_ptr> _caches;                         // thread caches of this pool
+    std::atomic<bool> _closed;                              // close() was called
+    std::atomic<int> _waiting;                              // checkouts waiting for a slot
+    std::atomic<uint64_t> _connects;                        // new connections
+    std::atomic<uint64_t> _reuses;                          // checkouts served from idle lists
+};
+
+inline void pooled_connection::release() {
+    if (_fd < 0) return ;
+    _pool->give_back(std::move(_host), _key, _fd);
+    _fd = -1;
+    _pool.reset();
+    return ;
+}
+
+inline void pooled_connection::discard() {
+    if (_fd < 0) return ;
+    _pool->drop(*_host, _fd);
+    _fd = -1;
+    _host.reset();
+    _pool.reset();
+    return ;
+}
+
+__NAMESPACE_Cgo_END__
+
+// DATE: 2024-08-03
+// FILENAME: conn_pool.h
+// AUTHOR: royi
+// END:
+
+#endif
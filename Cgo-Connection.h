@@ -0,0 +1,481 @@
+/*************************************************************************
+	> File Name: Cgo-Connection.h
+	> Author:Royi
+	> Mail:royi990001@gmail.com
+	> Describe: buffered non-blocking connection over Cgo::socket, with
+	            growable ring buffers filled and drained by readv/sendmsg
+************************************************************************/
+#ifndef _CONNECTION_H__
+#define _CONNECTION_H__
+
+#include "Cgo-Socket.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <sys/uio.h>
+
+__NAMESPACE_Cgo_BEGIN__
+
+/*************************************************************************
+* > Class Name: byte_ring
+* > Father class: none
+* > Describe: growable ring of bytes. The capacity is a power of two and
+            head and tail count bytes forever, so wrapping is a mask.
+            Data may sit in two pieces, the tail of the storage and its
+            head, which readv/writev take in one call. The ring only
+            grows when asked for more room than it has, and starts over
+            at offset 0 whenever it runs empty.
+ ************************************************************************/
+class byte_ring {
+public:
+
+    static constexpr size_t npos = (size_t)-1;
+
+    explicit byte_ring(size_t capacity = 0) :
+        _buf(nullptr), _cap(0), _head(0), _tail(0)
+    {
+        if (capacity != 0) this->reserve(capacity);
+    }
+
+    byte_ring(const byte_ring &) = delete;
+    byte_ring &operator=(const byte_ring &) = delete;
+
+    byte_ring(byte_ring &&other) noexcept :
+        _buf(std::move(other._buf)), _cap(other._cap), _head(other._head), _tail(other._tail)
+    {
+        other._cap = other._head = other._tail = 0;
+    }
+
+    byte_ring &operator=(byte_ring &&other) noexcept {
+        if (this != &other) {
+            _buf = std::move(other._buf);
+            _cap = other._cap;
+            _head = other._head;
+            _tail = other._tail;
+            other._cap = other._head = other._tail = 0;
+        }
+        return *this;
+    }
+
+    size_t size() const {
+        return _tail - _head;
+    }
+
+    bool empty() const {
+        return _tail == _head;
+    }
+
+    size_t capacity() const {
+        return _cap;
+    }
+
+    size_t available() const {
+        return _cap - this->size();
+    }
+
+    /*************************************************************************
+    * > class byte_ring
+    * > name : reserve
+    * > Describe: : make room for n more bytes, growing to the next power
+    *               of two and linearizing the data when it has to move
+     ************************************************************************/
+    void reserve(size_t n) {
+        size_t used = this->size();
+        if (_cap - used >= n) return ;
+        size_t cap = _cap ? _cap : 64;
+        while (cap - used < n) cap <<= 1;
+        std::unique_ptr<char[]> buf(new char[cap]);
+        this->copy_out(buf.get(), used);
+        _buf = std::move(buf);
+        _cap = cap;
+        _head = 0;
+        _tail = used;
+        return ;
+    }
+
+    /*************************************************************************
+    * > class byte_ring
+    * > name : readable
+    * > Describe: : the buffered data as up to two iovecs, front first;
+    *               returns how many were filled
+     ************************************************************************/
+    int readable(struct iovec iov[2]) const {
+        return this->segments(_head, this->size(), iov);
+    }
+
+    /*************************************************************************
+    * > class byte_ring
+    * > name : writable
+    * > Describe: : the free space as up to two iovecs, commit() what was
+    *               written into them; returns how many were filled
+     ************************************************************************/
+    int writable(struct iovec iov[2]) {
+        if (this->empty()) _head = _tail = 0;
+        return this->segments(_tail, this->available(), iov);
+    }
+
+    void commit(size_t n) {
+        _tail += std::min(n, this->available());
+        return ;
+    }
+
+    void consume(size_t n) {
+        _head += std::min(n, this->size());
+        if (_head == _tail) _head = _tail = 0;
+        return ;
+    }
+
+    void clear() {
+        _head = _tail = 0;
+        return ;
+    }
+
+    void append(const void *data, size_t len) {
+        this->reserve(len);
+        struct iovec iov[2];
+        int cnt = this->writable(iov);
+        const char *src = static_cast<const char *>(data);
+        for (int i = 0; i < cnt && len != 0; ++i) {
+            size_t n = std::min(len, iov[i].iov_len);
+            std::memcpy(iov[i].iov_base, src, n);
+            src += n;
+            len -= n;
+            _tail += n;
+        }
+        return ;
+    }
+
+    void append(std::string_view data) {
+        this->append(data.data(), data.size());
+        return ;
+    }
+
+    /*************************************************************************
+    * > class byte_ring
+    * > name : peek
+    * > Describe: : the contiguous front of the data without copying. It
+    *               holds everything unless the data wraps, see linearize()
+     ************************************************************************/
+    std::string_view peek() const {
+        struct iovec iov[2];
+        if (this->readable(iov) == 0) return std::string_view();
+        return std::string_view(static_cast<const char *>(iov[0].iov_base), iov[0].iov_len);
+    }
+
+    /*************************************************************************
+    * > class byte_ring
+    * > name : linearize
+    * > Describe: : all the data as one view, rotating the storage in place
+    *               when the data wraps. Views stay valid until the ring is
+    *               written to or consumed.
+     ************************************************************************/
+    std::string_view linearize() {
+        size_t used = this->size();
+        size_t off = _head & (_cap - 1);
+        if (used != 0 && off + used > _cap) {
+            std::rotate(_buf.get(), _buf.get() + off, _buf.get() + _cap);
+            _head = 0;
+            _tail = used;
+        }
+        return this->peek();
+    }
+
+    /*************************************************************************
+    * > class byte_ring
+    * > name : find
+    * > Describe: : offset of the first c at or after from, npos if none
+     ************************************************************************/
+    size_t find(char c, size_t from = 0) const {
+        struct iovec iov[2];
+        int cnt = this->readable(iov);
+        size_t base = 0;
+        for (int i = 0; i < cnt; ++i) {
+            size_t len = iov[i].iov_len;
+            if (from < base + len) {
+                const char *p = static_cast<const char *>(iov[i].iov_base);
+                size_t start = from > base ? from - base : 0;
+                const void *hit = std::memchr(p + start, c, len - start);
+                if (hit != nullptr) return base + (size_t)(static_cast<const char *>(hit) - p);
+            }
+            base += len;
+        }
+        return npos;
+    }
+
+    /*************************************************************************
+    * > class byte_ring
+    * > name : copy_out
+    * > Describe: : copy the first n buffered bytes to dst, nothing consumed
+     ************************************************************************/
+    size_t copy_out(void *dst, size_t n) const {
+        struct iovec iov[2];
+        int cnt = this->segments(_head, std::min(n, this->size()), iov);
+        char *out = static_cast<char *>(dst);
+        size_t done = 0;
+        for (int i = 0; i < cnt; ++i) {
+            std::memcpy(out + done, iov[i].iov_base, iov[i].iov_len);
+            done += iov[i].iov_len;
+        }
+        return done;
+    }
+
+    /*************************************************************************
+    * > class byte_ring
+    * > name : shrink
+    * > Describe: : give memory back after a burst, keeping at least keep
+    *               bytes of capacity and all the data
+     ************************************************************************/
+    void shrink(size_t keep) {
+        size_t cap = 64;
+        while (cap < keep || cap < this->size()) cap <<= 1;
+        if (cap >= _cap) return ;
+        std::unique_ptr<char[]> buf(new char[cap]);
+        size_t used = this->copy_out(buf.get(), this->size());
+        _buf = std::move(buf);
+        _cap = cap;
+        _head = 0;
+        _tail = used;
+        return ;
+    }
+
+private:
+
+    int segments(size_t from, size_t len, struct iovec iov[2]) const {
+        if (len == 0 || _cap == 0) return 0;
+        size_t off = from & (_cap - 1);
+        size_t first = std::min(len, _cap - off);
+        iov[0].iov_base = _buf.get() + off;
+        iov[0].iov_len = first;
+        if (first == len) return 1;
+        iov[1].iov_base = _buf.get();
+        iov[1].iov_len = len - first;
+        return 2;
+    }
+
+    std::unique_ptr<char[]> _buf;                           // storage of _cap bytes
+    size_t _cap;                                            // 0 or a power of two
+    size_t _head;                                           // first buffered byte
+    size_t _tail;                                           // one past the last buffered byte
+};
+
+/*************************************************************************
+* > Class Name: connection
+* > Father class: none
+* > Describe: non-blocking stream socket with an input and an output
+            byte_ring. fill() reads until the socket is drained, one
+            readv covering both free pieces of the input ring and a
+            stack buffer for the overflow, so one syscall usually takes
+            everything. write() sends at once when nothing is queued and
+            buffers the rest; flush() sends the whole output ring, many
+            queued messages at a time. Parsers read input() in place
+            and consume() what they used. Fits event_loop handlers:
+            on_read calls fill(), on_write calls flush().
+ ************************************************************************/
+template <typename T>
+class connection {
+    using socket_t = Cgo::socket<T>;
+
+    static constexpr size_t _extra_size = 65536;            // stack overflow buffer of fill()
+
+public:
+
+    /*************************************************************************
+    * > class connection
+    * > name : constructor
+    * > Describe: : take over sock and make it non-blocking. The rings
+    *               start with initial bytes of room each.
+     ************************************************************************/
+    explicit connection(socket_t sock, size_t initial = 4096) :
+        _sock(sock), _in(initial), _out(initial), _eof(false)
+    {
+        _sock.set_nonblocking(true);
+    }
+
+    connection(const connection &) = delete;
+    connection &operator=(const connection &) = delete;
+
+    int fd() const {
+        return (int)_sock;
+    }
+
+    socket_t &sock() {
+        return _sock;
+    }
+
+    byte_ring &input() {
+        return _in;
+    }
+
+    byte_ring &output() {
+        return _out;
+    }
+
+    /*************************************************************************
+    * > class connection
+    * > name : peer_closed
+    * > Describe: : the peer shut down its side, input() holds the rest
+     ************************************************************************/
+    bool peer_closed() const {
+        return _eof;
+    }
+
+    /*************************************************************************
+    * > class connection
+    * > name : pending
+    * > Describe: : bytes written but not yet accepted by the kernel
+     ************************************************************************/
+    size_t pending() const {
+        return _out.size();
+    }
+
+    /*************************************************************************
+    * > class connection
+    * > name : fill
+    * > Describe: : read until the socket would block
+    * > return : bytes added to input(). 0 means the peer closed with
+    *            nothing new, -1 an error with errno set, EAGAIN when
+    *            there was nothing to read.
+     ************************************************************************/
+    ::ssize_t fill() {
+        char extra[_extra_size];
+        ::ssize_t total = 0;
+        for (;;) {
+            struct iovec iov[3];
+            int cnt = _in.writable(iov);
+            size_t room = 0;
+            for (int i = 0; i < cnt; ++i) room += iov[i].iov_len;
+            iov[cnt].iov_base = extra;
+            iov[cnt].iov_len = sizeof(extra);
+            ::ssize_t n = ::readv((int)_sock, iov, cnt + 1);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                // an error after some data shows up on the next call
+                return total != 0 ? total : -1;
+            }
+            if (n == 0) {
+                _eof = true;
+                return total;
+            }
+            total += n;
+            if ((size_t)n <= room) {
+                _in.commit((size_t)n);
+            } else {
+                _in.commit(room);
+                _in.append(extra, (size_t)n - room);
+            }
+            // a short read drained the socket, skip the round that only sees EAGAIN
+            if ((size_t)n < room + sizeof(extra)) return total;
+        }
+    }
+
+    /*************************************************************************
+    * > class connection
+    * > name : write
+    * > Describe: : send data, buffering what the socket does not take now.
+    *               With output already queued the data is only appended,
+    *               keeping the order; flush() sends it.
+    * > return : len, or -1 on a socket error with errno set
+     ************************************************************************/
+    ::ssize_t write(const void *data, size_t len) {
+        size_t done = 0;
+        if (_out.empty()) {
+            while (done < len) {
+                ::ssize_t n = ::send((int)_sock, static_cast<const char *>(data) + done, len - done, MSG_NOSIGNAL);
+                if (n < 0) {
+                    if (errno == EINTR) continue;
+                    if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                    return -1;
+                }
+                done += (size_t)n;
+            }
+        }
+        if (done < len) _out.append(static_cast<const char *>(data) + done, len - done);
+        return (::ssize_t)len;
+    }
+
+    ::ssize_t write(std::string_view data) {
+        return this->write(data.data(), data.size());
+    }
+
+    /*************************************************************************
+    * > class connection
+    * > name : flush
+    * > Describe: : send the output ring until it is empty or the socket
+    *               would block, both ring pieces per sendmsg. sendmsg is
+    *               writev with MSG_NOSIGNAL, a closed peer is an EPIPE
+    *               error instead of a SIGPIPE.
+    * > return : bytes sent, -1 on a socket error with errno set
+     ************************************************************************/
+    ::ssize_t flush() {
+        ::ssize_t total = 0;
+        while (!_out.empty()) {
+            struct iovec iov[2];
+            struct msghdr msg = {};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = (size_t)_out.readable(iov);
+            ::ssize_t n = ::sendmsg((int)_sock, &msg, MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                return -1;
+            }
+            _out.consume((size_t)n);
+            total += n;
+        }
+        return total;
+    }
+
+    /*************************************************************************
+    * > class connection
+    * > name : send_file
+    * > Describe: : send part of a file or pipe with sendfile/splice after
+    *               the buffered output, see socket::send_file()
+    * > return : bytes of the file sent, -1 with errno set on error and
+    *            EAGAIN while buffered output is still in the way
+     ************************************************************************/
+    ::ssize_t send_file(int fd, ::off_t offset, size_t len) {
+        if (!_out.empty()) {
+            if (this->flush() < 0) return -1;
+            if (!_out.empty()) {
+                errno = EAGAIN;
+                return -1;
+            }
+        }
+        return _sock.send_file(fd, offset, len);
+    }
+
+    /*************************************************************************
+    * > class connection
+    * > name : shrink
+    * > Describe: : give ring memory back after a burst, down to keep bytes
+     ************************************************************************/
+    void shrink(size_t keep = 4096) {
+        _in.shrink(keep);
+        _out.shrink(keep);
+        return ;
+    }
+
+    int close() {
+        _in.clear();
+        _out.clear();
+        return _sock.close();
+    }
+
+private:
+    socket_t _sock;                                         // non-blocking socket
+    byte_ring _in;                                          // received, not yet consumed
+    byte_ring _out;                                         // written, not yet sent
+    bool _eof;                                              // peer shut down its side
+};
+
+__NAMESPACE_Cgo_END__
+
+// DATE: 2024-08-03
+// FILENAME: connection.h
+// AUTHOR: royi
+// END:
+
+#endif
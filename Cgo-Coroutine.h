@@ -0,0 +1,291 @@
+/*************************************************************************
+	> File Name: Cgo-Coroutine.h
+	> Author:Royi
+	> Mail:royi990001@gmail.com
+	> Describe: C++20 coroutine task type running on Cgo::thread_pool.
+	            Needs -std=c++20, the header is empty otherwise.
+************************************************************************/
+#ifndef _COROUTINE_H__
+#define _COROUTINE_H__
+
+#include "Cgo-ThreadPool.h"
+
+#ifdef __Cgo_COROUTINE__
+
+#include <optional>
+#include <utility>
+
+__NAMESPACE_Cgo_BEGIN__
+
+template <typename T = void>
+class co_task;
+
+/*************************************************************************
+* > Class Name: co_promise_base
+* > Father class: none
+* > Describe: promise part shared by every co_task. A co_task starts
+            suspended and runs when awaited. At its end it resumes the
+            awaiting coroutine by symmetric transfer, on the same thread
+            and without going through a queue.
+ ************************************************************************/
+class co_promise_base {
+
+    struct final_awaiter_t {
+        bool await_ready() const noexcept { return false; }
+
+        template <typename PROMISE_T>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<PROMISE_T> h) noexcept {
+            std::coroutine_handle<> next = h.promise()._continuation;
+            return next ? next : std::noop_coroutine();
+        }
+
+        void await_resume() const noexcept {}
+    };
+
+public:
+
+    std::suspend_always initial_suspend() const noexcept { return {}; }
+    final_awaiter_t final_suspend() const noexcept { return {}; }
+
+    void unhandled_exception() noexcept {
+        _error = std::current_exception();
+        return ;
+    }
+
+    void set_continuation(std::coroutine_handle<> h) noexcept {
+        _continuation = h;
+        return ;
+    }
+
+protected:
+
+    void rethrow_if_failed() {
+        if (_error) std::rethrow_exception(_error);
+        return ;
+    }
+
+private:
+    std::coroutine_handle<> _continuation;                  // coroutine awaiting this one
+    std::exception_ptr _error;                              // exception leaving the body
+};
+
+/*************************************************************************
+* > Class Name: co_promise
+* > Father class: co_promise_base
+* > Describe: keeps the co_return value of a co_task<T>
+ ************************************************************************/
+template <typename T>
+class co_promise : public co_promise_base {
+public:
+
+    co_task<T> get_return_object() noexcept;
+
+    template <typename VALUE_T>
+    void return_value(VALUE_T &&value) {
+        _value.emplace(std::forward<VALUE_T>(value));
+        return ;
+    }
+
+    T result() {
+        this->rethrow_if_failed();
+        return std::move(*_value);
+    }
+
+private:
+    std::optional<T> _value;                                // co_return value
+};
+
+/*************************************************************************
+* > Class Name: co_promise<void>
+* > Father class: co_promise_base
+ ************************************************************************/
+template <>
+class co_promise<void> : public co_promise_base {
+public:
+
+    co_task<void> get_return_object() noexcept;
+
+    void return_void() const noexcept {}
+
+    void result() {
+        this->rethrow_if_failed();
+        return ;
+    }
+};
+
+/*************************************************************************
+* > Class Name: co_task
+* > Father class: none
+* > Describe: lazy, move-only coroutine result. co_await runs the body on
+            the awaiting thread and yields its co_return value or
+            rethrows its exception. Use co_await pool.schedule() inside
+            the body to move it onto a thread_pool worker; everything
+            after that, including the awaiting coroutine, continues on
+            that worker.
+ ************************************************************************/
+template <typename T>
+class co_task {
+public:
+    using promise_type = co_promise<T>;
+    using handle_t = std::coroutine_handle<promise_type>;
+
+    /*************************************************************************
+    * > class co_task
+    * > name : awaiter_t
+    * > Describe: : starts the awaited task by symmetric transfer
+     ************************************************************************/
+    struct awaiter_t {
+        handle_t handle;
+
+        bool await_ready() const noexcept { return !handle || handle.done(); }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+            handle.promise().set_continuation(awaiting);
+            return handle;
+        }
+
+        T await_resume() {
+            return handle.promise().result();
+        }
+    };
+
+    /*************************************************************************
+    * > class co_task
+    * > name : ready_t
+    * > Describe: : like awaiter_t but leaves the result in the task
+     ************************************************************************/
+    struct ready_t : awaiter_t {
+        void await_resume() const noexcept {}
+    };
+
+    co_task() noexcept : _handle(nullptr) {}
+    explicit co_task(handle_t h) noexcept : _handle(h) {}
+    co_task(co_task &&other) noexcept : _handle(std::exchange(other._handle, nullptr)) {}
+    co_task(const co_task &) = delete;
+    co_task &operator=(const co_task &) = delete;
+
+    co_task &operator=(co_task &&other) noexcept {
+        if (this != &other) {
+            if (_handle) _handle.destroy();
+            _handle = std::exchange(other._handle, nullptr);
+        }
+        return *this;
+    }
+
+    ~co_task() {
+        if (_handle) _handle.destroy();
+    }
+
+    awaiter_t operator co_await() const & noexcept {
+        return awaiter_t{ _handle };
+    }
+
+    awaiter_t operator co_await() const && noexcept {
+        return awaiter_t{ _handle };
+    }
+
+    /*************************************************************************
+    * > class co_task
+    * > name : when_ready
+    * > Describe: : awaitable that runs the task to its end without taking
+    *               its result, read it afterwards with result()
+     ************************************************************************/
+    ready_t when_ready() const noexcept {
+        return ready_t{ { _handle } };
+    }
+
+    /*************************************************************************
+    * > class co_task
+    * > name : result
+    * > Describe: : co_return value of a finished task, rethrows its exception
+     ************************************************************************/
+    T result() {
+        return _handle.promise().result();
+    }
+
+    bool valid() const noexcept {
+        return (bool)_handle;
+    }
+
+    bool done() const noexcept {
+        return _handle && _handle.done();
+    }
+
+private:
+    handle_t _handle;                                       // owned coroutine frame
+};
+
+template <typename T>
+co_task<T> co_promise<T>::get_return_object() noexcept {
+    return co_task<T>(std::coroutine_handle<co_promise<T>>::from_promise(*this));
+}
+
+inline co_task<void> co_promise<void>::get_return_object() noexcept {
+    return co_task<void>(std::coroutine_handle<co_promise<void>>::from_promise(*this));
+}
+
+/*************************************************************************
+* > Class Name: co_detached
+* > Father class: none
+* > Describe: eager coroutine nobody waits for, its frame frees itself at
+            the end. Used to bridge co_task to plain threads.
+ ************************************************************************/
+struct co_detached {
+    struct promise_type {
+        co_detached get_return_object() const noexcept { return {}; }
+        std::suspend_never initial_suspend() const noexcept { return {}; }
+        std::suspend_never final_suspend() const noexcept { return {}; }
+        void return_void() const noexcept {}
+        void unhandled_exception() const noexcept { std::terminate(); }
+    };
+};
+
+/*************************************************************************
+* > Function Name: co_spawn
+* > Describe: run t on pool without waiting for it. The exception of a
+*             spawned task is lost, so t should handle its own errors.
+ ************************************************************************/
+inline co_detached co_spawn(thread_pool &pool, co_task<void> t) {
+    co_await pool.schedule();
+    try {
+        co_await t;
+    } catch (...) {}
+    co_return ;
+}
+
+/*************************************************************************
+* > Function Name: sync_wait
+* > Describe: block the calling thread until t finished and return its
+*             result. t runs on the calling thread until it reaches a
+*             co_await pool.schedule(). Must not be called from a worker
+*             the task needs.
+ ************************************************************************/
+template <typename T>
+T sync_wait(co_task<T> t) {
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    bool finished = false;
+    auto run = [&]() -> co_detached {
+        co_await t.when_ready();
+        std::unique_lock<std::mutex> locker(m_mutex);
+        finished = true;
+        m_cond.notify_all();
+    };
+    run();
+    {
+        std::unique_lock<std::mutex> locker(m_mutex);
+        while (!finished) m_cond.wait(locker);
+    }
+    return t.result();
+}
+
+__NAMESPACE_Cgo_END__
+
+#endif
+
+// DATE: 2024-08-03
+// FILENAME: coroutine.h
+// AUTHOR: royi
+// END:
+
+#endif
@@ -0,0 +1,638 @@
+/*************************************************************************
+	> File Name: Cgo-EventLoop.h
+	> Author:Royi
+	> Mail:royi990001@gmail.com
+	> Describe: edge triggered epoll reactor for Cgo::socket, paired with
+	            Cgo::thread_pool for CPU work
+************************************************************************/
+#ifndef _EVENT_LOOP_H__
+#define _EVENT_LOOP_H__
+
+#include "Cgo-ThreadPool.h"
+#include "Cgo-Socket.h"
+
+#include <system_error>
+#include <cerrno>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+__NAMESPACE_Cgo_BEGIN__
+
+/*************************************************************************
+* > Struct Name: io_handlers
+* > Describe: callbacks of one fd registered with an event_loop, all run
+*             on the loop thread. Any of them may be empty.
+ ************************************************************************/
+struct io_handlers {
+    std::function<void()> on_read;                          // readable or peer shut down, read until EAGAIN or end of file
+    std::function<void()> on_write;                         // writable again, write until EAGAIN
+    std::function<void()> on_close;                         // full hang up or error, fd is already removed
+    std::function<void()> on_errqueue;                      // MSG_ERRQUEUE reports only (zero copy), not an error
+};
+
+/*************************************************************************
+* > Class Name: event_loop
+* > Father class: none
+* > Describe: reactor over one epoll instance. Every fd is registered once
+            edge triggered for reading and writing, so a handler only
+            runs when the state changes and must drain the fd until
+            EAGAIN; no epoll_ctl is needed per read or write. One thread
+            runs the loop; other threads hand work to it with post().
+            CPU heavy work goes to the thread_pool with offload(), whose
+            result comes back to the loop thread. The loop does not own
+            the fds, on_close decides whether to close them.
+ ************************************************************************/
+class event_loop {
+
+    struct entry_t {
+        io_handlers handlers;                               // callbacks of the fd
+        uint32_t gen;                                       // tells reused fds apart
+    };
+
+    using callback_t = std::function<void()>;
+    using entry_ptr = std::unique_ptr<entry_t>;
+
+    static constexpr uint64_t _wake_key = UINT64_MAX;      // epoll data of the eventfd
+
+public:
+
+    /*************************************************************************
+    * > class event_loop
+    * > name : constructor
+    * > Describe: : pool runs offload() work, it may be nullptr. max_events
+    *               is the first size of the epoll_wait batch, it grows
+    *               when a batch comes back full. Throws std::system_error
+    *               when epoll or eventfd cannot be created.
+     ************************************************************************/
+    explicit event_loop(thread_pool *pool = nullptr, int max_events = 256) :
+        _pool(pool), _epfd(-1), _wakefd(-1), _gen(0), _count(0), _stop(false), _wake_pending(false), _running(false)
+    {
+        _epfd = ::epoll_create1(EPOLL_CLOEXEC);
+        if (_epfd < 0) throw std::system_error(errno, std::system_category(), "event_loop: epoll_create1");
+        _wakefd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (_wakefd < 0) {
+            int err = errno;
+            ::close(_epfd);
+            throw std::system_error(err, std::system_category(), "event_loop: eventfd");
+        }
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.u64 = _wake_key;
+        ::epoll_ctl(_epfd, EPOLL_CTL_ADD, _wakefd, &ev);
+        _events.resize(std::max(1, max_events));
+    }
+
+    event_loop(const event_loop &) = delete;
+    event_loop &operator=(const event_loop &) = delete;
+
+    /*************************************************************************
+    * > class event_loop
+    * > name : destructor
+    * > Describe: : registered fds stay open, posted work is dropped
+     ************************************************************************/
+    ~event_loop() {
+        ::close(_wakefd);
+        ::close(_epfd);
+    }
+
+    /*************************************************************************
+    * > class event_loop
+    * > name : add
+    * > Describe: : watch fd, which is switched to non-blocking. Called from
+    *               another thread while the loop runs, the registration is
+    *               posted to the loop thread; if it fails there, on_close
+    *               runs. Return false if fd could not be registered here.
+     ************************************************************************/
+    bool add(int fd, io_handlers handlers) {
+        if (!this->in_loop()) {
+            this->post([this, fd, h = std::move(handlers)]() mutable {
+                callback_t on_close = h.on_close;
+                if (!this->add(fd, std::move(h)) && on_close) on_close();
+            });
+            return true;
+        }
+        if (fd < 0) return false;
+        int flags = ::fcntl(fd, F_GETFL);
+        if (flags < 0 || ::fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) return false;
+        if ((size_t)fd >= _entries.size()) _entries.resize((size_t)fd + 1);
+        if (_entries[fd] != nullptr) return false;
+        _gen = (_gen + 1 == 0) ? 1 : _gen + 1;
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.u64 = ((uint64_t)_gen << 32) | (uint32_t)fd;
+        if (::epoll_ctl(_epfd, EPOLL_CTL_ADD, fd, &ev) < 0) return false;
+        _entries[fd].reset(new entry_t{ std::move(handlers), _gen });
+        _count += 1;
+        return true;
+    }
+
+    /*************************************************************************
+    * > class event_loop
+    * > name : remove
+    * > Describe: : stop watching fd without calling on_close. Safe inside
+    *               a handler of the same fd. Posted like add() when called
+    *               from another thread.
+     ************************************************************************/
+    bool remove(int fd) {
+        if (!this->in_loop()) {
+            this->post([this, fd] { this->remove(fd); });
+            return true;
+        }
+        if (fd < 0 || (size_t)fd >= _entries.size() || _entries[fd] == nullptr) return false;
+        ::epoll_ctl(_epfd, EPOLL_CTL_DEL, fd, nullptr);
+        this->detach(fd);
+        return true;
+    }
+
+    /*************************************************************************
+    * > class event_loop
+    * > name : post
+    * > Describe: : run fn on the loop thread during its next round. The
+    *               eventfd is only written when the queue was empty.
+     ************************************************************************/
+    void post(callback_t fn) {
+        bool wake = false;
+        {
+            std::unique_lock<std::mutex> locker(m_mutex);
+            _posted.push_back(std::move(fn));
+            if (!_wake_pending) {
+                _wake_pending = true;
+                wake = true;
+            }
+        }
+        if (wake) this->wakeup();
+        return ;
+    }
+
+    /*************************************************************************
+    * > class event_loop
+    * > name : run_in_loop
+    * > Describe: : run fn here when called on the loop thread or the loop
+    *               is not running, post it otherwise. Decided under the
+    *               lock run() takes to finish, so fn neither gets lost in
+    *               a loop that is stopping nor runs beside it.
+     ************************************************************************/
+    void run_in_loop(callback_t fn) {
+        bool wake = false;
+        {
+            std::unique_lock<std::mutex> locker(m_mutex);
+            std::thread::id owner = _owner.load(std::memory_order_relaxed);
+            if (owner != std::this_thread::get_id() && (_running || owner != std::thread::id())) {
+                _posted.push_back(std::move(fn));
+                if (!_wake_pending) {
+                    _wake_pending = true;
+                    wake = true;
+                }
+                fn = nullptr;
+            }
+        }
+        if (wake) this->wakeup();
+        if (fn) fn();
+        return ;
+    }
+
+    /*************************************************************************
+    * > class event_loop
+    * > name : offload
+    * > Describe: : run work() on the thread_pool, then done(result) back on
+    *               the loop thread, done() for void work. The loop must
+    *               outlive the work. The result and done may be move only.
+    *               Return false if the loop has no pool or the pool
+    *               refused it.
+     ************************************************************************/
+    template <typename WORK_T, typename DONE_T>
+    bool offload(WORK_T work, DONE_T done) {
+        if (_pool == nullptr) return false;
+        // posted work is a std::function, so done and the result are boxed
+        // to let either of them be move only
+        auto cb = std::make_shared<DONE_T>(std::move(done));
+        return _pool->add_task([this, work = std::move(work), cb]() mutable {
+            if constexpr (std::is_void<std::invoke_result_t<WORK_T &>>::value) {
+                work();
+                this->post([cb] { (*cb)(); });
+            } else {
+                auto result = std::make_shared<std::invoke_result_t<WORK_T &>>(work());
+                this->post([cb, result] { (*cb)(std::move(*result)); });
+            }
+        });
+    }
+
+    /*************************************************************************
+    * > class event_loop
+    * > name : run_once
+    * > Describe: : wait up to timeout_ms (-1 forever) for events and run
+    *               their handlers, then the posted work. Return the number
+    *               of events, -1 with errno set on failure.
+     ************************************************************************/
+    int run_once(int timeout_ms = -1) {
+        _owner.store(std::this_thread::get_id(), std::memory_order_relaxed);
+        int n = ::epoll_wait(_epfd, _events.data(), (int)_events.size(), timeout_ms);
+        if (n < 0) return errno == EINTR ? 0 : -1;
+        bool posted = false;
+        for (int i = 0; i < n; ++i) {
+            uint64_t key = _events[i].data.u64;
+            if (key == _wake_key) {
+                posted = true;
+                continue;
+            }
+            this->dispatch((int)(uint32_t)key, (uint32_t)(key >> 32), _events[i].events);
+        }
+        _dead.clear();
+        if (posted) this->run_posted();
+        if ((size_t)n == _events.size()) _events.resize(_events.size() * 2);
+        return n;
+    }
+
+    /*************************************************************************
+    * > class event_loop
+    * > name : run
+    * > Describe: : run rounds on the calling thread until stop(). Work
+    *               posted by then still runs before it returns; after that
+    *               the loop counts as not running, see in_loop().
+     ************************************************************************/
+    void run() {
+        {
+            std::unique_lock<std::mutex> locker(m_mutex);
+            _running = true;
+        }
+        while (!_stop.load(std::memory_order_acquire)) {
+            if (this->run_once(-1) < 0) break;
+        }
+        for (;;) {
+            {
+                // from here on run_in_loop() runs work on its caller
+                std::unique_lock<std::mutex> locker(m_mutex);
+                if (_posted.empty()) {
+                    _running = false;
+                    _owner.store(std::thread::id(), std::memory_order_relaxed);
+                    break;
+                }
+            }
+            this->run_posted();
+        }
+        _stop.store(false, std::memory_order_relaxed);
+        return ;
+    }
+
+    /*************************************************************************
+    * > class event_loop
+    * > name : stop
+    * > Describe: : make run() return after the current round, thread safe
+     ************************************************************************/
+    void stop() {
+        _stop.store(true, std::memory_order_release);
+        this->wakeup();
+        return ;
+    }
+
+    /*************************************************************************
+    * > class event_loop
+    * > name : in_loop
+    * > Describe: : called on the loop thread, or the loop is not running
+     ************************************************************************/
+    bool in_loop() const {
+        std::thread::id owner = _owner.load(std::memory_order_relaxed);
+        return owner == std::thread::id() || owner == std::this_thread::get_id();
+    }
+
+    /*************************************************************************
+    * > class event_loop
+    * > name : bind_thread
+    * > Describe: : make the calling thread the loop thread before it runs,
+    *               so add() from other threads is posted from now on
+     ************************************************************************/
+    void bind_thread() {
+        _owner.store(std::this_thread::get_id(), std::memory_order_relaxed);
+        return ;
+    }
+
+    /*************************************************************************
+    * > class event_loop
+    * > name : size
+    * > Describe: : registered fds, read on the loop thread
+     ************************************************************************/
+    size_t size() const {
+        return _count;
+    }
+
+    thread_pool *pool() const {
+        return _pool;
+    }
+
+private:
+
+    /*************************************************************************
+    * > class event_loop
+    * > name : lookup
+    * > Describe: : entry of fd if it is still the registration of gen
+     ************************************************************************/
+    entry_t *lookup(int fd, uint32_t gen) const {
+        if ((size_t)fd >= _entries.size()) return nullptr;
+        entry_t *e = _entries[fd].get();
+        return (e != nullptr && e->gen == gen) ? e : nullptr;
+    }
+
+    /*************************************************************************
+    * > class event_loop
+    * > name : detach
+    * > Describe: : forget fd. The entry lives until the end of the round,
+    *               a handler of it may still be running.
+     ************************************************************************/
+    void detach(int fd) {
+        _dead.push_back(std::move(_entries[fd]));
+        _count -= 1;
+        return ;
+    }
+
+    /*************************************************************************
+    * > class event_loop
+    * > name : dispatch
+    * > Describe: : run the handlers of one event. Data is read before a
+    *               hang up is reported, and every handler may remove the
+    *               fd, so it is looked up again after each call. A peer
+    *               that only shut down its writing side (EPOLLRDHUP) is
+    *               end of file for on_read; the fd stays registered so a
+    *               response can still be written.
+     ************************************************************************/
+    void dispatch(int fd, uint32_t gen, uint32_t events) {
+        entry_t *e = this->lookup(fd, gen);
+        if (e != nullptr && (events & EPOLLERR) && !(events & EPOLLHUP) && e->handlers.on_errqueue) {
+            // EPOLLERR also means "error queue not empty", SO_ERROR tells a real error apart
+            int err = 0;
+            socklen_t len = sizeof(err);
+            if (::getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err == 0) {
+                events &= ~(uint32_t)EPOLLERR;
+                e->handlers.on_errqueue();
+                e = this->lookup(fd, gen);
+            }
+        }
+        if (e != nullptr && (events & (EPOLLIN | EPOLLPRI | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) {
+            if (e->handlers.on_read) e->handlers.on_read();
+            e = this->lookup(fd, gen);
+        }
+        if (e != nullptr && (events & EPOLLOUT) && !(events & (EPOLLHUP | EPOLLERR))) {
+            if (e->handlers.on_write) e->handlers.on_write();
+            e = this->lookup(fd, gen);
+        }
+        if (e != nullptr && (events & (EPOLLHUP | EPOLLERR))) {
+            ::epoll_ctl(_epfd, EPOLL_CTL_DEL, fd, nullptr);
+            this->detach(fd);
+            if (e->handlers.on_close) e->handlers.on_close();
+        }
+        return ;
+    }
+
+    /*************************************************************************
+    * > class event_loop
+    * > name : run_posted
+    * > Describe: : run the work posted so far, later posts wait for the
+    *               next round
+     ************************************************************************/
+    void run_posted() {
+        uint64_t count;
+        while (::read(_wakefd, &count, sizeof(count)) > 0) {}
+        std::vector<callback_t> posted;
+        {
+            std::unique_lock<std::mutex> locker(m_mutex);
+            posted.swap(_posted);
+            _wake_pending = false;
+        }
+        for (auto &fn : posted) fn();
+        _dead.clear();
+        return ;
+    }
+
+    /*************************************************************************
+    * > class event_loop
+    * > name : wakeup
+    * > Describe: : make epoll_wait return
+     ************************************************************************/
+    void wakeup() {
+        uint64_t one = 1;
+        ssize_t ret = ::write(_wakefd, &one, sizeof(one));
+        (void)ret;
+        return ;
+    }
+
+    thread_pool *_pool;                                     // runs offload() work, may be nullptr
+    int _epfd;                                              // epoll instance
+    int _wakefd;                                            // eventfd for post() and stop()
+    uint32_t _gen;                                          // generation of the last add()
+    size_t _count;                                          // registered fds
+    std::vector<entry_ptr> _entries;                        // registrations indexed by fd
+    std::vector<entry_ptr> _dead;                           // removed this round, freed at its end
+    std::vector<struct epoll_event> _events;                // epoll_wait batch
+    std::atomic<std::thread::id> _owner;                    // loop thread, empty before the first round
+    std::atomic<bool> _stop;                                // set by stop()
+    std::mutex m_mutex;                                     // mutex for _posted
+    std::vector<callback_t> _posted;                        // work for the loop thread
+    bool _wake_pending;                                     // eventfd written since the last round
+    bool _running;                                          // inside run(), guarded by m_mutex
+};
+
+/*************************************************************************
+* > Class Name: event_loop_group
+* > Father class: none
+* > Describe: a few event_loops, each on its own thread. Hand new
+            connections out with next(), one loop per core serves many
+            thousands of connections.
+ ************************************************************************/
+class event_loop_group {
+public:
+
+    /*************************************************************************
+    * > class event_loop_group
+    * > name : constructor
+    * > Describe: : start loops threads, all offloading to pool. With pin
+    *               loop i stays on the i-th allowed cpu, see cpu_of().
+     ************************************************************************/
+    explicit event_loop_group(int loops, thread_pool *pool = nullptr, bool pin = false) : _next(0) {
+        std::vector<cpu_info> cpus;
+        if (pin) cpus = cpu_topology::detect();
+        for (int i = 0; i < std::max(1, loops); ++i) {
+            _loops.emplace_back(new event_loop(pool));
+            _cpus.push_back(cpus.empty() ? -1 : cpus[(size_t)i % cpus.size()].cpu);
+        }
+        for (size_t i = 0; i < _loops.size(); ++i) {
+            event_loop *l = _loops[i].get();
+            int cpu = _cpus[i];
+            std::promise<void> bound;
+            std::future<void> ready = bound.get_future();
+            _threads.emplace_back([l, cpu, &bound] {
+                if (cpu >= 0) cpu_topology::bind_this_thread({ cpu });
+                l->bind_thread();
+                bound.set_value();
+                l->run();
+            });
+            ready.wait();
+        }
+    }
+
+    event_loop_group(const event_loop_group &) = delete;
+    event_loop_group &operator=(const event_loop_group &) = delete;
+
+    ~event_loop_group() {
+        this->stop();
+    }
+
+    /*************************************************************************
+    * > class event_loop_group
+    * > name : next
+    * > Describe: : loops in turn, for spreading connections
+     ************************************************************************/
+    event_loop &next() {
+        size_t i = _next.fetch_add(1, std::memory_order_relaxed);
+        return *_loops[i % _loops.size()];
+    }
+
+    event_loop &at(size_t i) {
+        return *_loops[i];
+    }
+
+    size_t size() const {
+        return _loops.size();
+    }
+
+    // cpu loop i is pinned to, -1 when not pinned
+    int cpu_of(size_t i) const {
+        return _cpus[i];
+    }
+
+    /*************************************************************************
+    * > class event_loop_group
+    * > name : stop
+    * > Describe: : stop every loop and join the threads
+     ************************************************************************/
+    void stop() {
+        for (auto &loop : _loops) loop->stop();
+        for (auto &t : _threads) {
+            if (t.joinable()) t.join();
+        }
+        return ;
+    }
+
+private:
+    std::vector<std::unique_ptr<event_loop>> _loops;        // one per thread
+    std::vector<std::thread> _threads;                      // thread of _loops[i]
+    std::vector<int> _cpus;                                 // cpu of _loops[i], -1 for any
+    std::atomic<size_t> _next;                              // round robin position
+};
+
+/*************************************************************************
+* > Class Name: sharded_listener
+* > Father class: none
+* > Describe: one SO_REUSEPORT listener per loop of an event_loop_group,
+            all on the same port, so accepting scales with the loops
+            instead of queueing behind one thread. Each loop drains its
+            own listener in batches with accept4 and hands every new
+            socket, already non-blocking, to on_accept on that loop.
+            With a pinned group the listeners are also steered by cpu:
+            a connection is accepted on the core that took its packets.
+ ************************************************************************/
+class sharded_listener {
+public:
+
+    using accept_cb = std::function<void(event_loop &, int)>;
+
+    /*************************************************************************
+    * > class sharded_listener
+    * > name : constructor
+    * > Describe: : open group.size() listeners on port (0 picks one for
+    *               all, see port()) and start accepting. Throws
+    *               std::system_error when a listener cannot be opened.
+     ************************************************************************/
+    sharded_listener(event_loop_group &group, uint16_t port, accept_cb on_accept, int backlog = 1024, int batch = 64) :
+        _group(group), _port(port), _steered(false), _on_accept(std::make_shared<accept_cb>(std::move(on_accept)))
+    {
+        for (size_t i = 0; i < group.size(); ++i) {
+            socket<tcp_ip4> sock;
+            if (sock.init_shard(_port, backlog) < 0) {
+                int err = errno;
+                for (auto &s : _socks) s.close();
+                throw std::system_error(err, std::system_category(), "sharded_listener: listen");
+            }
+            if (_port == 0) {
+                sockaddr<tcp_ip4> addr;
+                ::getsockname(sock, (struct ::sockaddr *)&addr.get_addr(), &addr.get_len());
+                _port = addr.show_prot();
+            }
+            _socks.push_back(sock);
+        }
+        std::vector<int> cpus;
+        for (size_t i = 0; i < group.size() && group.cpu_of(i) >= 0; ++i) cpus.push_back(group.cpu_of(i));
+        // steering needs one shard per cpu, more loops than cpus keep the hash
+        std::vector<int> distinct(cpus);
+        std::sort(distinct.begin(), distinct.end());
+        bool unique = std::unique(distinct.begin(), distinct.end()) == distinct.end();
+        if (cpus.size() == group.size() && group.size() > 1 && unique) _steered = (_socks[0].steer_by_cpu(cpus) == 0);
+        for (size_t i = 0; i < _socks.size(); ++i) {
+            event_loop &loop = group.at(i);
+            int fd = _socks[i];
+            std::shared_ptr<accept_cb> cb = _on_accept;
+            io_handlers h;
+            // fds is only touched on the loop thread
+            h.on_read = [&loop, fd, cb, fds = std::vector<int>((size_t)std::max(1, batch))]() mutable {
+                int n;
+                do {
+                    n = socket<tcp_ip4>(fd).accept_batch(fds.data(), (int)fds.size());
+                    for (int k = 0; k < n; ++k) (*cb)(loop, fds[(size_t)k]);
+                } while (n == (int)fds.size());
+                return ;
+            };
+            loop.add(fd, std::move(h));
+        }
+    }
+
+    sharded_listener(const sharded_listener &) = delete;
+    sharded_listener &operator=(const sharded_listener &) = delete;
+
+    ~sharded_listener() {
+        this->close();
+    }
+
+    uint16_t port() const {
+        return _port;
+    }
+
+    // connections are steered to the cpu of their shard
+    bool steered() const {
+        return _steered;
+    }
+
+    /*************************************************************************
+    * > class sharded_listener
+    * > name : close
+    * > Describe: : stop accepting; each running loop unregisters and
+    *               closes its listener during its next round, or before
+    *               run() returns. The listener of a loop that is not
+    *               running is closed here.
+     ************************************************************************/
+    void close() {
+        for (size_t i = 0; i < _socks.size(); ++i) {
+            event_loop &loop = _group.at(i);
+            int fd = _socks[i];
+            loop.run_in_loop([&loop, fd] {
+                loop.remove(fd);
+                ::close(fd);
+            });
+        }
+        _socks.clear();
+        return ;
+    }
+
+private:
+    event_loop_group &_group;                               // loops the shards run on
+    uint16_t _port;                                         // port of every shard
+    bool _steered;                                          // cpu steering program attached
+    std::shared_ptr<accept_cb> _on_accept;                  // shared with the handlers
+    std::vector<socket<tcp_ip4>> _socks;                    // listener of loop i
+};
+
+__NAMESPACE_Cgo_END__
+
+// DATE: 2024-08-03
+// FILENAME: event_loop.h
+// AUTHOR: royi
+// END:
+
+#endif
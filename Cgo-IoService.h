@@ -0,0 +1,438 @@
+/*************************************************************************
+	> File Name: Cgo-IoService.h
+	> Author:Royi
+	> Mail:royi990001@gmail.com
+	> Describe: completion based socket I/O interface and its epoll backend
+************************************************************************/
+#ifndef _IO_SERVICE_H__
+#define _IO_SERVICE_H__
+
+#include "Cgo-EventLoop.h"
+
+#include <deque>
+#include <unordered_map>
+
+__NAMESPACE_Cgo_BEGIN__
+
+/*************************************************************************
+* > Class Name: io_service
+* > Father class: none
+* > Describe: asynchronous accept, recv, send and connect on sockets. Every
+            operation ends with exactly one final callback: an error,
+            end of file or -ECANCELED after cancel(). accept() and recv()
+            are continuous, they report every connection or chunk of
+            data until their final callback. Results follow the syscalls:
+            a value >= 0 on success, -errno on failure. Callbacks run on
+            the thread calling run(); operations are started on that
+            thread too, or before it runs. Use post() from other threads.
+            epoll_service and uring_service implement it, so a server
+            written against io_service can be benchmarked on both.
+ ************************************************************************/
+class io_service {
+public:
+    using accept_cb = std::function<void(int fd)>;                              // new fd, final when < 0
+    using recv_cb = std::function<void(const char *data, ssize_t n)>;           // data valid during the call, final when n <= 0
+    using send_cb = std::function<void(ssize_t n)>;                             // all len bytes sent, or -errno
+    using connect_cb = std::function<void(int res)>;                            // 0 once connected, or -errno
+
+    explicit io_service(thread_pool *pool) : _pool(pool) {}
+    virtual ~io_service() = default;
+
+    io_service(const io_service &) = delete;
+    io_service &operator=(const io_service &) = delete;
+
+    /*************************************************************************
+    * > class io_service
+    * > name : accept
+    * > Describe: : accept connections on listening socket fd until cancelled.
+    *               New sockets are non-blocking and close on exec.
+     ************************************************************************/
+    virtual void accept(int fd, accept_cb cb) = 0;
+
+    /*************************************************************************
+    * > class io_service
+    * > name : recv
+    * > Describe: : receive from fd until end of file, error or cancel()
+     ************************************************************************/
+    virtual void recv(int fd, recv_cb cb) = 0;
+
+    /*************************************************************************
+    * > class io_service
+    * > name : send
+    * > Describe: : send len bytes of buf, which must stay valid until cb.
+    *               Sends on one fd go out in the order they were started.
+     ************************************************************************/
+    virtual void send(int fd, const void *buf, size_t len, send_cb cb) = 0;
+
+    /*************************************************************************
+    * > class io_service
+    * > name : connect
+    * > Describe: : connect non-blocking socket fd to addr, which is copied
+     ************************************************************************/
+    virtual void connect(int fd, const struct ::sockaddr *addr, socklen_t len, connect_cb cb) = 0;
+
+    /*************************************************************************
+    * > class io_service
+    * > name : cancel
+    * > Describe: : end every operation on fd with -ECANCELED, call it
+    *               before closing fd
+     ************************************************************************/
+    virtual void cancel(int fd) = 0;
+
+    /*************************************************************************
+    * > class io_service
+    * > name : run_once
+    * > Describe: : wait up to timeout_ms (-1 forever) and run completions
+    *               and posted work. Return the number handled, -1 on error.
+     ************************************************************************/
+    virtual int run_once(int timeout_ms = -1) = 0;
+
+    /*************************************************************************
+    * > class io_service
+    * > name : post
+    * > Describe: : run fn on the thread running the service, thread safe
+     ************************************************************************/
+    virtual void post(std::function<void()> fn) = 0;
+
+    /*************************************************************************
+    * > class io_service
+    * > name : stop
+    * > Describe: : make run() return, thread safe
+     ************************************************************************/
+    virtual void stop() = 0;
+
+    /*************************************************************************
+    * > class io_service
+    * > name : run
+    * > Describe: : run rounds until stop()
+     ************************************************************************/
+    virtual void run() = 0;
+
+    /*************************************************************************
+    * > class io_service
+    * > name : name
+    * > Describe: : backend name for logs and benchmarks
+     ************************************************************************/
+    virtual const char *name() const = 0;
+
+    /*************************************************************************
+    * > class io_service
+    * > name : offload
+    * > Describe: : run work() on the thread_pool, then done(result) back on
+    *               the service thread, done() for void work. Let the pool go
+    *               idle before the service is destroyed. The result and done
+    *               may be move only. Return false if the service has no pool
+    *               or the pool refused it.
+     ************************************************************************/
+    template <typename WORK_T, typename DONE_T>
+    bool offload(WORK_T work, DONE_T done) {
+        if (_pool == nullptr) return false;
+        // posted work is a std::function, so done and the result are boxed
+        // to let either of them be move only
+        auto cb = std::make_shared<DONE_T>(std::move(done));
+        return _pool->add_task([this, work = std::move(work), cb]() mutable {
+            if constexpr (std::is_void<std::invoke_result_t<WORK_T &>>::value) {
+                work();
+                this->post([cb] { (*cb)(); });
+            } else {
+                auto result = std::make_shared<std::invoke_result_t<WORK_T &>>(work());
+                this->post([cb, result] { (*cb)(std::move(*result)); });
+            }
+        });
+    }
+
+    thread_pool *pool() const {
+        return _pool;
+    }
+
+protected:
+    thread_pool *_pool;                                     // runs offload() work, may be nullptr
+};
+
+/*************************************************************************
+* > Class Name: epoll_service
+* > Father class: io_service
+* > Describe: io_service on top of event_loop. Operations are tried when
+            the fd turns ready and run until EAGAIN, costing one syscall
+            per accept, recv or send. A send is tried at once and only
+            waits for the fd when the socket buffer is full.
+ ************************************************************************/
+class epoll_service : public io_service {
+
+    struct send_t {
+        const char *buf;                                    // user data
+        size_t len;                                         // bytes to send
+        size_t done;                                        // bytes sent so far
+        send_cb cb;                                         // final callback
+    };
+
+    struct fd_state_t {
+        accept_cb on_accept;                                // pending accept(), if any
+        recv_cb on_recv;                                    // pending recv(), if any
+        connect_cb on_connect;                              // pending connect(), if any
+        std::deque<send_t> sends;                           // pending sends in order
+        bool registered = false;                            // added to the event_loop
+    };
+
+    using state_ptr = std::shared_ptr<fd_state_t>;
+    using fd_map_t = std::unordered_map<int, state_ptr>;
+
+    static constexpr size_t _recv_size = 64 * 1024;        // bytes read by one recv
+
+public:
+
+    /*************************************************************************
+    * > class epoll_service
+    * > name : constructor
+    * > Describe: : pool runs offload() work, it may be nullptr
+     ************************************************************************/
+    explicit epoll_service(thread_pool *pool = nullptr) :
+        io_service(pool), _loop(pool), _buf(new char[_recv_size])
+    {}
+
+    void accept(int fd, accept_cb cb) override {
+        fd_state_t &s = this->state(fd);
+        s.on_accept = std::move(cb);
+        this->watch(fd, s);
+        this->on_read(fd);
+        return ;
+    }
+
+    void recv(int fd, recv_cb cb) override {
+        fd_state_t &s = this->state(fd);
+        s.on_recv = std::move(cb);
+        this->watch(fd, s);
+        this->on_read(fd);
+        return ;
+    }
+
+    void send(int fd, const void *buf, size_t len, send_cb cb) override {
+        fd_state_t &s = this->state(fd);
+        s.sends.push_back(send_t{ static_cast<const char *>(buf), len, 0, std::move(cb) });
+        this->watch(fd, s);
+        // behind a pending connect the loop starts the sends
+        if (s.sends.size() == 1 && !s.on_connect) this->flush(fd);
+        return ;
+    }
+
+    void connect(int fd, const struct ::sockaddr *addr, socklen_t len, connect_cb cb) override {
+        if (::connect(fd, addr, len) == 0) {
+            cb(0);
+            return ;
+        }
+        if (errno != EINPROGRESS) {
+            cb(-errno);
+            return ;
+        }
+        fd_state_t &s = this->state(fd);
+        s.on_connect = std::move(cb);
+        this->watch(fd, s);
+        return ;
+    }
+
+    void cancel(int fd) override {
+        auto it = _fds.find(fd);
+        if (it == _fds.end()) return ;
+        if (it->second->registered) _loop.remove(fd);
+        this->finish(it, -ECANCELED);
+        return ;
+    }
+
+    int run_once(int timeout_ms = -1) override {
+        int n = _loop.run_once(timeout_ms);
+        _retired.clear();
+        return n;
+    }
+
+    void post(std::function<void()> fn) override {
+        _loop.post(std::move(fn));
+        return ;
+    }
+
+    void stop() override {
+        _loop.stop();
+        return ;
+    }
+
+    void run() override {
+        _loop.run();
+        _retired.clear();
+        return ;
+    }
+
+    const char *name() const override {
+        return "epoll";
+    }
+
+private:
+
+    fd_state_t &state(int fd) {
+        state_ptr &s = _fds[fd];
+        if (s == nullptr) s = std::make_shared<fd_state_t>();
+        return *s;
+    }
+
+    /*************************************************************************
+    * > class epoll_service
+    * > name : watch
+    * > Describe: : register fd with the loop on first use
+     ************************************************************************/
+    void watch(int fd, fd_state_t &s) {
+        if (s.registered) return ;
+        s.registered = true;
+        io_handlers h;
+        h.on_read = [this, fd] { this->on_read(fd); };
+        h.on_write = [this, fd] { this->on_write(fd); };
+        h.on_close = [this, fd] { this->on_close(fd); };
+        _loop.add(fd, std::move(h));
+        return ;
+    }
+
+    /*************************************************************************
+    * > class epoll_service
+    * > name : on_read
+    * > Describe: : accept or receive until EAGAIN. A callback may cancel
+    *               fd, so the state is looked up again after each one.
+     ************************************************************************/
+    void on_read(int fd) {
+        for (;;) {
+            auto it = _fds.find(fd);
+            if (it == _fds.end()) return ;
+            fd_state_t &s = *it->second;
+            if (s.on_accept) {
+                int conn = ::accept4(fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if (conn >= 0) {
+                    s.on_accept(conn);
+                    continue;
+                }
+                if (errno == EAGAIN || errno == EWOULDBLOCK) return ;
+                if (errno == EINTR || errno == ECONNABORTED) continue;
+                accept_cb cb = std::move(s.on_accept);
+                cb(-errno);
+                continue;
+            }
+            if (!s.on_recv) return ;
+            ssize_t n = ::recv(fd, _buf.get(), _recv_size, 0);
+            if (n > 0) {
+                s.on_recv(_buf.get(), n);
+                continue;
+            }
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return ;
+            if (n < 0 && errno == EINTR) continue;
+            recv_cb cb = std::move(s.on_recv);
+            cb(nullptr, n < 0 ? -errno : 0);
+        }
+    }
+
+    /*************************************************************************
+    * > class epoll_service
+    * > name : on_write
+    * > Describe: : writable again. Finish a pending connect once the socket
+    *               is really connected, then send what is queued.
+     ************************************************************************/
+    void on_write(int fd) {
+        auto it = _fds.find(fd);
+        if (it == _fds.end()) return ;
+        if (it->second->on_connect) {
+            int err = 0;
+            socklen_t len = sizeof(err);
+            ::getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len);
+            if (err == 0) {
+                struct ::sockaddr_storage peer;
+                socklen_t peer_len = sizeof(peer);
+                if (::getpeername(fd, reinterpret_cast<struct ::sockaddr *>(&peer), &peer_len) < 0) {
+                    // still in progress, the next EPOLLOUT or EPOLLERR tells
+                    if (errno == ENOTCONN) return ;
+                    err = errno;
+                }
+            }
+            connect_cb cb = std::move(it->second->on_connect);
+            it->second->on_connect = nullptr;
+            cb(-err);
+            it = _fds.find(fd);
+            if (it == _fds.end()) return ;
+            if (err != 0) {
+                // SO_ERROR is read and cleared, fail the rest here
+                if (it->second->registered) _loop.remove(fd);
+                this->finish(it, -err);
+                return ;
+            }
+        }
+        this->flush(fd);
+        return ;
+    }
+
+    /*************************************************************************
+    * > class epoll_service
+    * > name : flush
+    * > Describe: : send queued data until EAGAIN
+     ************************************************************************/
+    void flush(int fd) {
+        auto it = _fds.find(fd);
+        if (it == _fds.end()) return ;
+        while (!it->second->sends.empty()) {
+            send_t &op = it->second->sends.front();
+            ssize_t n = ::send(fd, op.buf + op.done, op.len - op.done, MSG_NOSIGNAL);
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return ;
+            if (n < 0 && errno == EINTR) continue;
+            if (n >= 0) op.done += (size_t)n;
+            if (n >= 0 && op.done < op.len) continue;
+            send_cb cb = std::move(op.cb);
+            ssize_t res = n < 0 ? -errno : (ssize_t)op.len;
+            it->second->sends.pop_front();
+            cb(res);
+            it = _fds.find(fd);
+            if (it == _fds.end()) return ;
+        }
+        return ;
+    }
+
+    /*************************************************************************
+    * > class epoll_service
+    * > name : on_close
+    * > Describe: : hang up, fail what is still pending
+     ************************************************************************/
+    void on_close(int fd) {
+        auto it = _fds.find(fd);
+        if (it == _fds.end()) return ;
+        int err = 0;
+        socklen_t len = sizeof(err);
+        ::getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        this->finish(it, err != 0 ? -err : -EPIPE);
+        return ;
+    }
+
+    /*************************************************************************
+    * > class epoll_service
+    * > name : finish
+    * > Describe: : forget fd and give every pending operation its final
+    *               callback with res; a pending recv gets end of file
+    *               after a hang up without error. The state is kept until
+    *               the end of the round, one of its callbacks may be the
+    *               one calling cancel().
+     ************************************************************************/
+    void finish(fd_map_t::iterator it, int res) {
+        state_ptr s = std::move(it->second);
+        _fds.erase(it);
+        _retired.push_back(s);
+        if (s->on_accept) s->on_accept(res);
+        if (s->on_recv) s->on_recv(nullptr, res == -EPIPE ? 0 : res);
+        if (s->on_connect) s->on_connect(res);
+        for (auto &op : s->sends) op.cb(res);
+        return ;
+    }
+
+    event_loop _loop;                                       // readiness source
+    fd_map_t _fds;                                          // pending operations per fd
+    std::vector<state_ptr> _retired;                        // finished this round, freed at its end
+    std::unique_ptr<char[]> _buf;                           // recv buffer shared by all fds
+};
+
+__NAMESPACE_Cgo_END__
+
+// DATE: 2024-08-03
+// FILENAME: io_service.h
+// AUTHOR: royi
+// END:
+
+#endif
@@ -0,0 +1,223 @@
+/*************************************************************************
+	> File Name: Cgo-Parallel.h
+	> Author:Royi
+	> Mail:royi990001@gmail.com
+	> Describe: parallel_for, parallel_reduce and parallel_transform on top
+	            of Cgo::thread_pool
+************************************************************************/
+#ifndef _PARALLEL_H__
+#define _PARALLEL_H__
+
+#include "Cgo-ThreadPool.h"
+
+#include <optional>
+
+__NAMESPACE_Cgo_BEGIN__
+
+/*************************************************************************
+* > Class Name: parallel_range
+* > Father class: none
+* > Describe: split [0, n) over a thread_pool. A range longer than grain
+            keeps its left half and hands the right half to the pool, so
+            the owner works through ever smaller pieces from the back of
+            its deque while thieves take the large halves from the front.
+            The calling thread runs the leftmost piece itself and then
+            helps with queued tasks until every piece is done.
+ ************************************************************************/
+template <typename BODY_T>
+class parallel_range {
+
+    struct split_t {
+        parallel_range *range;
+        size_t lo;
+        size_t hi;
+
+        void operator()() const {
+            try {
+                range->split(lo, hi);
+            } catch (...) {
+                range->_wg.fail(std::current_exception());
+            }
+            range->_wg.done();
+            return ;
+        }
+    };
+
+public:
+
+    /*************************************************************************
+    * > class parallel_range
+    * > name : constructor
+    * > Describe: : body is called as body(lo, hi) for disjoint pieces
+     ************************************************************************/
+    parallel_range(thread_pool &pool, BODY_T &body, size_t grain) :
+        _pool(pool), _body(body), _grain(grain < 1 ? 1 : grain)
+    {}
+
+    /*************************************************************************
+    * > class parallel_range
+    * > name : run
+    * > Describe: : cover [0, n) and return once every piece ran. The first
+    *               exception thrown by body is rethrown here, after the
+    *               pieces already handed out have finished.
+     ************************************************************************/
+    void run(size_t n) {
+        try {
+            this->split(0, n);
+        } catch (...) {
+            _wg.fail(std::current_exception());
+        }
+        _pool.wait(_wg);
+        return ;
+    }
+
+    /*************************************************************************
+    * > class parallel_range
+    * > name : split
+    * > Describe: : hand right halves to the pool, run what is left. The
+    *               halves are spawned, so a bounded pool never refuses
+    *               or drops a piece of a started range.
+     ************************************************************************/
+    void split(size_t lo, size_t hi) {
+        while (hi - lo > _grain) {
+            size_t mid = lo + (hi - lo) / 2;
+            _wg.add(1);
+            _pool.spawn(split_t{ this, mid, hi });
+            hi = mid;
+        }
+        if (lo < hi) _body(lo, hi);
+        return ;
+    }
+
+private:
+
+    thread_pool &_pool;                                     // pool running the pieces
+    BODY_T &_body;                                          // body(lo, hi)
+    size_t _grain;                                          // pieces are never split below this
+    wait_group _wg;                                         // pieces handed to the pool
+};
+
+/*************************************************************************
+* > Function Name: parallel_grain
+* > Describe: default grain, about eight pieces per worker so stealing can
+*             even out uneven pieces
+ ************************************************************************/
+inline size_t parallel_grain(thread_pool &pool, size_t n) {
+    size_t threads = (size_t)std::max(1, pool.get_thread_num());
+    size_t grain = n / (threads * 8);
+    return grain < 1 ? 1 : grain;
+}
+
+/*************************************************************************
+* > Function Name: parallel_at
+* > Describe: element i of a range: begin + i for integral indices,
+*             *(begin + i) for random access iterators
+ ************************************************************************/
+template <typename INDEX_T>
+decltype(auto) parallel_at(INDEX_T begin, size_t i) {
+    if constexpr (std::is_integral<INDEX_T>::value) {
+        return (INDEX_T)(begin + (INDEX_T)i);
+    } else {
+        return *(begin + (typename std::iterator_traits<INDEX_T>::difference_type)i);
+    }
+}
+
+/*************************************************************************
+* > Function Name: parallel_size
+* > Describe: number of elements in [begin, end), 0 if end is before begin
+ ************************************************************************/
+template <typename INDEX_T>
+size_t parallel_size(INDEX_T begin, INDEX_T end) {
+    if constexpr (std::is_integral<INDEX_T>::value) {
+        return end > begin ? (size_t)(end - begin) : 0;
+    } else {
+        auto n = std::distance(begin, end);
+        return n > 0 ? (size_t)n : 0;
+    }
+}
+
+/*************************************************************************
+* > Function Name: parallel_for
+* > Describe: call fn(i) for every index in [begin, end), or fn(*it) for
+*             every element when begin and end are random access
+*             iterators. grain 0 picks parallel_grain().
+ ************************************************************************/
+template <typename INDEX_T, typename FUNC_T>
+void parallel_for(thread_pool &pool, INDEX_T begin, INDEX_T end, FUNC_T &&fn, size_t grain = 0) {
+    size_t n = parallel_size(begin, end);
+    if (n == 0) return ;
+    if (grain == 0) grain = parallel_grain(pool, n);
+    auto body = [&](size_t lo, size_t hi) {
+        for (size_t i = lo; i < hi; ++i) fn(parallel_at(begin, i));
+    };
+    parallel_range<decltype(body)>(pool, body, grain).run(n);
+    return ;
+}
+
+/*************************************************************************
+* > Function Name: parallel_reduce
+* > Describe: fold map(element) over [begin, end) with reduce, starting
+*             from identity. Every piece folds its elements in order and
+*             the partial results are combined left to right, so reduce
+*             only has to be associative, not commutative.
+ ************************************************************************/
+template <typename INDEX_T, typename VALUE_T, typename REDUCE_T, typename MAP_T>
+VALUE_T parallel_reduce(thread_pool &pool, INDEX_T begin, INDEX_T end, VALUE_T identity,
+                        REDUCE_T reduce, MAP_T map, size_t grain = 0) {
+    size_t n = parallel_size(begin, end);
+    if (n == 0) return identity;
+    if (grain == 0) grain = parallel_grain(pool, n);
+    if (grain < 1) grain = 1;
+    // every piece is at least half a grain long, so lo / step is unique
+    size_t step = std::max<size_t>(1, (grain + 1) / 2);
+    std::vector<std::optional<VALUE_T>> partial(n / step + 1);
+    auto body = [&](size_t lo, size_t hi) {
+        VALUE_T acc = identity;
+        for (size_t i = lo; i < hi; ++i) acc = reduce(std::move(acc), map(parallel_at(begin, i)));
+        partial[lo / step].emplace(std::move(acc));
+    };
+    parallel_range<decltype(body)>(pool, body, grain).run(n);
+    VALUE_T result = std::move(identity);
+    for (auto &p : partial) {
+        if (p) result = reduce(std::move(result), std::move(*p));
+    }
+    return result;
+}
+
+/*************************************************************************
+* > Function Name: parallel_reduce
+* > Describe: fold the elements (or indices) of [begin, end) with reduce
+ ************************************************************************/
+template <typename INDEX_T, typename VALUE_T, typename REDUCE_T>
+VALUE_T parallel_reduce(thread_pool &pool, INDEX_T begin, INDEX_T end, VALUE_T identity, REDUCE_T reduce) {
+    return parallel_reduce(pool, begin, end, std::move(identity), std::move(reduce),
+                           [](auto &&v) -> decltype(auto) { return std::forward<decltype(v)>(v); });
+}
+
+/*************************************************************************
+* > Function Name: parallel_transform
+* > Describe: write fn(*(first + i)) to *(out + i) for every element of
+*             [first, last). Both ranges must be random access and must
+*             not overlap unless out == first. Return the end of the output.
+ ************************************************************************/
+template <typename IN_T, typename OUT_T, typename FUNC_T>
+OUT_T parallel_transform(thread_pool &pool, IN_T first, IN_T last, OUT_T out, FUNC_T &&fn, size_t grain = 0) {
+    using diff_t = typename std::iterator_traits<OUT_T>::difference_type;
+    size_t n = parallel_size(first, last);
+    if (n == 0) return out;
+    if (grain == 0) grain = parallel_grain(pool, n);
+    auto body = [&](size_t lo, size_t hi) {
+        for (size_t i = lo; i < hi; ++i) *(out + (diff_t)i) = fn(parallel_at(first, i));
+    };
+    parallel_range<decltype(body)>(pool, body, grain).run(n);
+    return out + (diff_t)n;
+}
+
+__NAMESPACE_Cgo_END__
+
+// DATE: 2024-08-03
+// FILENAME: parallel.h
+// AUTHOR: royi
+// END:
+
+#endif
@@ -25,6 +25,31 @@
 #include <memory>
 #include <type_traits>
 #include <sys/un.h>
+#include <netinet/udp.h>
+#include <linux/filter.h>
+#include <sys/stat.h>
+#include <poll.h>
+#include <sys/sendfile.h>
+#include <linux/errqueue.h>
+#include <algorithm>
+#include <cerrno>
+#include <deque>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
 
 
 #define __NAMESPACE_Cgo_BEGIN__ namespace Cgo {
@@ -35,6 +60,7 @@ __NAMESPACE_Cgo_BEGIN__
 // mark
 class tcp_ip4 {};
 class tcp_unix {};
+class udp_ip4 {};
 
 template <class T> class sockaddr;
 template <class T> class socket;
@@ -54,6 +80,11 @@ struct sockaddr_traits<class tcp_unix> {
     using type = struct ::sockaddr_un;
 };
 
+template <>
+struct sockaddr_traits<class udp_ip4> {
+	using type = struct ::sockaddr_in;
+};
+
 
 template <typename T>
 class _base_sockaddr {
@@ -125,6 +156,58 @@ public:
 		return this->sockfd;
 	}
 
+	/**
+	 * @brief switch O_NONBLOCK of the socket
+	 * @details
+	 *		Sockets registered with Cgo::event_loop must be non-blocking,
+	 *	recv() and send() then return -1 with errno EAGAIN instead of waiting.
+	 * @param on (bool) true for non-blocking, false for blocking
+	 * @return (int)
+	 *		On success, zero is returned.  On error, -1 is returned,
+	 *	and errno is set appropriately.
+	 */
+	int set_nonblocking(bool on = true) {
+		int flags = ::fcntl(this->sockfd, F_GETFL);
+		if (flags < 0) return -1;
+		flags = on ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+		return ::fcntl(this->sockfd, F_SETFL, flags);
+	}
+
+	/**
+	 * @brief send part of a file or a pipe without copying it through user space
+	 * @details
+	 *		A regular file goes out with sendfile(2) straight from the page cache,
+	 *	a pipe with splice(2) from the pipe buffer. Sends until len bytes are out,
+	 *	the source ends or a non-blocking socket is full.
+	 * @param fd (int) source descriptor, a regular file or a pipe
+	 * @param offset (::off_t) file offset to start at, ignored for a pipe
+	 * @param len (::size_t) bytes to send
+	 * @return (::ssize_t)
+	 *		Bytes sent, less than len when the socket filled up or the source
+	 *	ended. When nothing was sent -1 is returned, and errno is set appropriately.
+	 */
+	::ssize_t send_file(int fd, ::off_t offset, ::size_t len) {
+		struct ::stat st;
+		if (::fstat(fd, &st) < 0) return -1;
+		bool from_pipe = S_ISFIFO(st.st_mode);
+		::size_t done = 0;
+		while (done < len) {
+			// sendfile moves at most 0x7ffff000 bytes per call
+			::size_t chunk = std::min<::size_t>(len - done, 0x7ffff000);
+			::ssize_t n = from_pipe ?
+				::splice(fd, nullptr, this->sockfd, nullptr, chunk, SPLICE_F_MOVE) :
+				::sendfile(this->sockfd, fd, &offset, chunk);
+			if (n < 0) {
+				if (errno == EINTR) continue;
+				if (done != 0) break;
+				return -1;
+			}
+			if (n == 0) break;
+			done += (::size_t)n;
+		}
+		return (::ssize_t)done;
+	}
+
 	virtual int bind(Cgo::sockaddr<T> &) = 0;
 	virtual int listen(int) = 0; 
 	virtual csocket_t accept() = 0;
@@ -411,6 +494,105 @@ public:
 		return 0;
 	}
 
+	/**
+	 * @brief allow other sockets to bind the same address and port
+	 * @details
+	 *		With SO_REUSEPORT on every one of them, the kernel spreads incoming
+	 *	connections over all listeners of the port by a hash of the 4-tuple.
+	 * @return (int)
+	 *		On success, zero is returned.  On error, -1 is returned,
+	 *	and errno is set appropriately.
+	 */
+	int set_reuseport(bool on = true) {
+		int val = on ? 1 : 0;
+		return ::setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &val, sizeof(val));
+	}
+
+	/**
+	 * @brief init one listener of a SO_REUSEPORT group
+	 * @details
+	 *		Like init(), but the socket is non-blocking and close-on-exec and
+	 *	joins the group of listeners on port; the order of the calls is the
+	 *	index used by steer_by_cpu().
+	 * @param port (const uint16_t) port, the same for every shard
+	 * @param backlog (int) backlog of this shard
+	 * @return (int)
+	 *		On success, zero is returned.  On error, -1 is returned, errno is
+	 *	set appropriately and the socket is closed.
+	 */
+	int init_shard(const uint16_t port, int backlog = 1024) {
+		addr_t taddr(INADDR_ANY, port);
+		int one = 1;
+		this->sockfd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (this->sockfd < 0) return -1;
+		if (::setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0 ||
+			this->set_reuseport(true) < 0 ||
+			this->bind(taddr) < 0 ||
+			this->listen(backlog) < 0) {
+			int err = errno;
+			::close(sockfd);
+			this->sockfd = -1;
+			errno = err;
+			return -1;
+		}
+		return 0;
+	}
+
+	/**
+	 * @brief accept every pending connection, up to max
+	 * @details
+	 *		accept4() hands out the new sockets already non-blocking and
+	 *	close-on-exec, which saves two fcntl calls per connection. Connections
+	 *	aborted before they were accepted are skipped.
+	 * @param fds (int *) receives the new descriptors
+	 * @param max (int) room in fds
+	 * @return (int)
+	 *		Number of descriptors stored, 0 when none was pending. When nothing
+	 *	was accepted because of an error, -1 is returned and errno is set.
+	 */
+	int accept_batch(int *fds, int max) {
+		int count = 0;
+		while (count < max) {
+			int fd = ::accept4(sockfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+			if (fd >= 0) {
+				fds[count++] = fd;
+				continue;
+			}
+			if (errno == EINTR || errno == ECONNABORTED) continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK || count != 0) break;
+			return -1;
+		}
+		return count;
+	}
+
+	/**
+	 * @brief send connections to the shard running on the receiving cpu
+	 * @details
+	 *		Attaches a classic BPF program to the SO_REUSEPORT group of this
+	 *	socket. It returns i when the packet is handled on cpus[i], which makes
+	 *	the kernel pick the i-th listener that joined the group; the accepting
+	 *	thread then works on data that is hot in its own cache. On any other
+	 *	cpu the usual hash decides.
+	 * @param cpus (const std::vector<int> &) cpu of every shard, in join order
+	 * @return (int)
+	 *		On success, zero is returned.  On error, -1 is returned,
+	 *	and errno is set appropriately.
+	 */
+	int steer_by_cpu(const std::vector<int> &cpus) {
+		std::vector<struct sock_filter> code;
+		code.push_back(BPF_STMT(BPF_LD | BPF_W | BPF_ABS, (uint32_t)(SKF_AD_OFF + SKF_AD_CPU)));
+		for (::size_t i = 0; i < cpus.size(); ++i) {
+			code.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, (uint32_t)cpus[i], 0, 1));
+			code.push_back(BPF_STMT(BPF_RET | BPF_K, (uint32_t)i));
+		}
+		// out of range, the kernel falls back to the hash
+		code.push_back(BPF_STMT(BPF_RET | BPF_K, 0xffffffffu));
+		struct sock_fprog prog;
+		prog.len = (unsigned short)code.size();
+		prog.filter = code.data();
+		return ::setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog));
+	}
+
 	self accept() override {
 		int fd = ::accept(sockfd, NULL, NULL);
 		if (fd < 0) {
@@ -485,6 +667,46 @@ public:
 		return ::connect(sockfd, (struct ::sockaddr *)&addr.get_addr(), addr.get_len());
 	}
 
+	/**
+	 * @brief connect, giving up after timeout_ms
+	 * @details
+	 *		The connect runs non-blocking and poll() waits for it, so an
+	 *	unreachable peer costs timeout_ms instead of the kernel's SYN retries.
+	 *	The socket is left in the blocking mode it had before.
+	 * @param addr (Cgo::tcpSocketaddr &) address to connect to
+	 * @param timeout_ms (int) longest wait, negative to wait forever
+	 * @return (int) On success, zero is returned. On error, -1 is returned
+	 *	and errno is set appropriately, ETIMEDOUT when the time ran out.
+	 */
+	int connect(addr_t &addr, int timeout_ms) {
+		int flags = ::fcntl(sockfd, F_GETFL);
+		if (flags < 0) return -1;
+		if (!(flags & O_NONBLOCK) && ::fcntl(sockfd, F_SETFL, flags | O_NONBLOCK) < 0) return -1;
+		int ret = ::connect(sockfd, (struct ::sockaddr *)&addr.get_addr(), addr.get_len());
+		if (ret < 0 && errno == EINPROGRESS) {
+			struct pollfd pfd = { sockfd, POLLOUT, 0 };
+			do {
+				ret = ::poll(&pfd, 1, timeout_ms);
+			} while (ret < 0 && errno == EINTR);
+			if (ret == 0) {
+				errno = ETIMEDOUT;
+				ret = -1;
+			} else if (ret > 0) {
+				int err = 0;
+				socklen_t len = sizeof(err);
+				ret = ::getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &err, &len);
+				if (ret == 0 && err != 0) {
+					errno = err;
+					ret = -1;
+				}
+			}
+		}
+		int err = errno;
+		if (!(flags & O_NONBLOCK)) ::fcntl(sockfd, F_SETFL, flags);
+		errno = err;
+		return ret;
+	}
+
 	/**
 	 * @brief close the socket
 	 * @details if the socket is not open, it will not be closed. And notihing 
@@ -645,6 +867,598 @@ public:
 	}
 };
 
+/**
+ * @brief IPv4 address of a udp_ip4 socket
+ * @details the same sockaddr_in as tcp_ip4, kept as its own type so
+ *	a socket<udp_ip4> only takes UDP addresses
+ */
+template <>
+class sockaddr<Cgo::udp_ip4> : public _base_sockaddr<Cgo::udp_ip4> {
+	using self = sockaddr<Cgo::udp_ip4>;
+	using used_t = Cgo::udp_ip4;
+	using addr_t = typename Cgo::sockaddr_traits<Cgo::udp_ip4>::type;
+	using len_t = socklen_t ;
+
+private:
+
+	addr_t addr;
+	len_t flush_len() override {
+		this->len = sizeof(this->addr);
+		return this->len;
+	}
+
+public:
+
+	/**
+	 * @brief Default constructor, INADDR_ANY port 0
+	 */
+	sockaddr()
+	{
+		::memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(0);
+		addr.sin_addr.s_addr = htonl(INADDR_ANY);
+		this->flush_len();
+	}
+
+	/**
+	 * @param add (const uint32_t) IP address in host order, usually INADDR_ANY on the server side
+	 * @param port (const uint16_t) port
+	 */
+	sockaddr(const uint32_t add, const uint16_t port)
+	{
+		::memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(port);
+		addr.sin_addr.s_addr = htonl(add);
+		this->flush_len();
+	}
+
+	/**
+	 * @param p (const char *) dotted IP address
+	 * @param port (const uint16_t) port
+	 */
+	sockaddr(const char *p, const uint16_t port)
+	{
+		::memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(port);
+		addr.sin_addr.s_addr = inet_addr(p);
+		this->flush_len();
+	}
+
+	sockaddr(const struct sockaddr_in *addr) :
+		addr(*addr)
+	{
+		this->flush_len();
+	}
+
+	sockaddr(const Cgo::sockaddr<used_t> &other) :
+		addr(other.addr)
+	{
+		this->flush_len();
+	}
+
+	void _message() override {
+		std::cout << "family: " << addr.sin_family << std::endl;
+		std::cout << "port: " << ::ntohs(addr.sin_port) << std::endl;
+		std::cout << "addr: " << ::inet_ntoa(addr.sin_addr) << std::endl;
+		std::cout << "len: " << len << std::endl;
+		return ;
+	}
+
+	char *show_ip() {
+		return ::inet_ntoa(addr.sin_addr);
+	}
+
+	uint16_t show_prot() {
+		return ::ntohs(addr.sin_port);
+	}
+
+	addr_t &get_addr() override {
+		return this->addr;
+	}
+
+	len_t &get_len() override {
+		return this->len;
+	}
+
+	void set_port(const int port) {
+		this->addr.sin_port = ::htons(port);
+		return ;
+	}
+
+	void set_addr(const char *ip) {
+		this->addr.sin_addr.s_addr = ::inet_addr(ip);
+		return ;
+	}
+
+	~sockaddr() = default;
+};
+
+/**
+ * @brief a batch of datagrams for socket<udp_ip4>::recv_batch and send_batch
+ * @details
+ *		All arrays recvmmsg/sendmmsg need are allocated once, so a batch is
+ *	reused for every call and costs no allocation per packet.
+ *		Receiving fills the batch from its own buffers, buffer_size bytes each.
+ *	With GRO on, one message may carry several datagrams of the same peer
+ *	coalesced by the kernel; segment() is their size and for_each() splits
+ *	them again. Give such a batch 64 KiB buffers.
+ *		Sending takes pointers to the caller's data, nothing is copied. With
+ *	a segment size, one message is cut into datagrams of that size by the
+ *	kernel or the NIC (GSO), up to 64 of them and 64 KiB per message.
+ */
+class udp_batch {
+	using addr_t = Cgo::sockaddr<Cgo::udp_ip4>;
+
+	static constexpr ::size_t _align = 64;
+	static constexpr ::size_t _control_size = CMSG_SPACE(sizeof(int));
+
+public:
+
+	/**
+	 * @param count (::size_t) messages per call
+	 * @param buffer_size (::size_t) bytes of every receive buffer, 0 for a batch only used to send
+	 */
+	explicit udp_batch(::size_t count, ::size_t buffer_size = 2048) :
+		msgs(count), iov(count), addrs(count), control(count * _control_size / sizeof(uint64_t) + 1),
+		buffers(nullptr, &udp_batch::free_buffers),
+		buffer_size((buffer_size + _align - 1) & ~(_align - 1)), used(0), sent(0)
+	{
+		if (this->buffer_size != 0) {
+			this->buffers.reset(static_cast<char *>(::operator new(this->buffer_size * count, std::align_val_t(_align))));
+		}
+	}
+
+	udp_batch(const udp_batch &) = delete;
+	udp_batch &operator=(const udp_batch &) = delete;
+
+	::size_t capacity() const {
+		return this->msgs.size();
+	}
+
+	/**
+	 * @brief messages received by the last recv_batch, or queued to send
+	 */
+	::size_t size() const {
+		return this->used;
+	}
+
+	std::string_view data(::size_t i) const {
+		return std::string_view(static_cast<const char *>(this->iov[i].iov_base), this->msgs[i].msg_len);
+	}
+
+	const struct ::sockaddr_in &peer(::size_t i) const {
+		return this->addrs[i];
+	}
+
+	/**
+	 * @brief GRO segment size of message i, 0 when it is a single datagram
+	 */
+	uint16_t segment(::size_t i) const {
+		const struct msghdr &h = this->msgs[i].msg_hdr;
+		for (struct cmsghdr *cm = CMSG_FIRSTHDR(&h); cm != nullptr; cm = CMSG_NXTHDR(const_cast<struct msghdr *>(&h), cm)) {
+			if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+				int size;
+				::memcpy(&size, CMSG_DATA(cm), sizeof(size));
+				return (uint16_t)size;
+			}
+		}
+		return 0;
+	}
+
+	/**
+	 * @brief the datagram was longer than the buffer and was cut
+	 */
+	bool truncated(::size_t i) const {
+		return (this->msgs[i].msg_hdr.msg_flags & MSG_TRUNC) != 0;
+	}
+
+	/**
+	 * @brief call fn(std::string_view, const sockaddr_in &) for every received
+	 *	datagram, splitting GRO messages
+	 */
+	template <typename FN>
+	void for_each(FN &&fn) const {
+		for (::size_t i = 0; i < this->used; ++i) {
+			std::string_view d = this->data(i);
+			::size_t seg = this->segment(i);
+			if (seg == 0) seg = d.size() ? d.size() : 1;
+			do {
+				fn(d.substr(0, seg), this->addrs[i]);
+				d.remove_prefix(std::min(seg, d.size()));
+			} while (!d.empty());
+		}
+		return ;
+	}
+
+	/**
+	 * @brief forget the queued or received messages
+	 */
+	void clear() {
+		this->used = 0;
+		this->sent = 0;
+		return ;
+	}
+
+	/**
+	 * @brief queue one message to send, the data is not copied
+	 * @param data (const void *) payload, valid until it is sent
+	 * @param len (::size_t) bytes of payload
+	 * @param to (const addr_t *) destination, nullptr on a connected socket
+	 * @param segment (uint16_t) GSO datagram size, 0 to send len as one datagram
+	 * @return (bool) false when the batch is full
+	 */
+	bool push(const void *data, ::size_t len, const addr_t *to = nullptr, uint16_t segment = 0) {
+		if (this->used == this->msgs.size()) return false;
+		::size_t i = this->used++;
+		this->iov[i].iov_base = const_cast<void *>(data);
+		this->iov[i].iov_len = len;
+		struct msghdr &h = this->msgs[i].msg_hdr;
+		h = {};
+		h.msg_iov = &this->iov[i];
+		h.msg_iovlen = 1;
+		if (to != nullptr) {
+			this->addrs[i] = const_cast<addr_t *>(to)->get_addr();
+			h.msg_name = &this->addrs[i];
+			h.msg_namelen = sizeof(this->addrs[i]);
+		}
+		if (segment != 0 && len > segment) {
+			h.msg_control = this->control_of(i);
+			h.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+			struct cmsghdr *cm = CMSG_FIRSTHDR(&h);
+			cm->cmsg_level = SOL_UDP;
+			cm->cmsg_type = UDP_SEGMENT;
+			cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+			::memcpy(CMSG_DATA(cm), &segment, sizeof(segment));
+		}
+		return true;
+	}
+
+	/**
+	 * @brief messages queued but not sent yet
+	 */
+	::size_t pending() const {
+		return this->used - this->sent;
+	}
+
+private:
+	friend class Cgo::socket<Cgo::udp_ip4>;
+
+	static void free_buffers(char *p) {
+		::operator delete(p, std::align_val_t(_align));
+	}
+
+	char *control_of(::size_t i) {
+		return reinterpret_cast<char *>(this->control.data()) + i * _control_size;
+	}
+
+	// point every message at its own buffer before recvmmsg
+	void prepare_recv() {
+		for (::size_t i = 0; i < this->msgs.size(); ++i) {
+			this->iov[i].iov_base = this->buffers.get() + i * this->buffer_size;
+			this->iov[i].iov_len = this->buffer_size;
+			struct msghdr &h = this->msgs[i].msg_hdr;
+			h = {};
+			h.msg_iov = &this->iov[i];
+			h.msg_iovlen = 1;
+			h.msg_name = &this->addrs[i];
+			h.msg_namelen = sizeof(this->addrs[i]);
+			h.msg_control = this->control_of(i);
+			h.msg_controllen = _control_size;
+		}
+		this->used = 0;
+		this->sent = 0;
+		return ;
+	}
+
+	std::vector<struct ::mmsghdr> msgs;
+	std::vector<struct ::iovec> iov;
+	std::vector<struct ::sockaddr_in> addrs;
+	std::vector<uint64_t> control;                  // cmsg space, 8 byte aligned
+	std::unique_ptr<char, void (*)(char *)> buffers;
+	::size_t buffer_size;
+	::size_t used;
+	::size_t sent;
+};
+
+/**
+ * @brief UDP over IPv4
+ * @details
+ *		Besides the datagram forms of recv and send, recv_batch and send_batch
+ *	move a whole udp_batch with one recvmmsg or sendmmsg. listen and accept
+ *	have no meaning for UDP and fail with EOPNOTSUPP.
+ */
+template <>
+class socket<Cgo::udp_ip4> : public Cgo::_base_socket<Cgo::udp_ip4> {
+	using self = Cgo::socket<Cgo::udp_ip4>;
+	using used_t = Cgo::udp_ip4;
+	using base_t = Cgo::_base_socket<Cgo::udp_ip4>;
+	using addr_t = Cgo::sockaddr<Cgo::udp_ip4>;
+	using socket_t = int;
+private:
+
+	bool is_sockfd_open() {
+		return ::fcntl(sockfd, F_GETFL) != -1;
+	}
+
+public:
+
+	socket() : base_t::_base_socket() {}
+
+	socket(const int fd) : base_t::_base_socket(fd) {}
+
+	socket(const self &other) :
+		base_t::_base_socket(other.sockfd)
+	{}
+
+	~socket() = default;
+
+	/**
+	 * @brief make the object to a datagram socket
+	 */
+	socket_t socket_construct() {
+		this->sockfd = ::socket(AF_INET, SOCK_DGRAM, 0);
+		return sockfd;
+	}
+
+	int bind(addr_t &addr) override {
+		return ::bind(sockfd, (struct ::sockaddr *)&addr.get_addr(), addr.get_len());
+	}
+
+	int listen(int = 0) override {
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+
+	self accept() override {
+		errno = EOPNOTSUPP;
+		return self(-1);
+	}
+
+	self accept(addr_t &) override {
+		errno = EOPNOTSUPP;
+		return self(-1);
+	}
+
+	/**
+	 * @brief set the default peer, recv then only takes its datagrams
+	 */
+	int connect(addr_t &addr) override {
+		return ::connect(sockfd, (struct ::sockaddr *)&addr.get_addr(), addr.get_len());
+	}
+
+	::ssize_t recv(void *buf, ::size_t len, int flags = 0) override {
+		return ::recv(this->sockfd, buf, len, flags);
+	}
+
+	::ssize_t send(const void *buf, ::size_t len, int flags = 0) override {
+		return ::send(this->sockfd, buf, len, flags);
+	}
+
+	/**
+	 * @brief receive one datagram and its sender
+	 */
+	::ssize_t recv_from(void *buf, ::size_t len, addr_t &from, int flags = 0) {
+		from.get_len() = sizeof(from.get_addr());
+		return ::recvfrom(this->sockfd, buf, len, flags, (struct ::sockaddr *)&from.get_addr(), &from.get_len());
+	}
+
+	/**
+	 * @brief send one datagram to to
+	 */
+	::ssize_t send_to(const void *buf, ::size_t len, addr_t &to, int flags = 0) {
+		return ::sendto(this->sockfd, buf, len, flags, (struct ::sockaddr *)&to.get_addr(), to.get_len());
+	}
+
+	/**
+	 * @brief let the kernel coalesce datagrams of one flow (UDP_GRO, Linux 5.0)
+	 * @return (int)
+	 *		On success, zero is returned. On error, -1 is returned with errno
+	 *	ENOPROTOOPT when the kernel has no UDP GRO; datagrams then come one by one.
+	 */
+	int enable_gro(bool on = true) {
+		int val = on ? 1 : 0;
+		return ::setsockopt(this->sockfd, SOL_UDP, UDP_GRO, &val, sizeof(val));
+	}
+
+	/**
+	 * @brief receive up to batch.capacity() datagrams with one recvmmsg
+	 * @param batch (udp_batch &) receives the messages, earlier content is dropped
+	 * @param flags (int) recvmmsg flags, e.g. MSG_DONTWAIT or MSG_WAITFORONE
+	 * @return (int)
+	 *		Messages received. On error, -1 is returned, and errno is set appropriately.
+	 */
+	int recv_batch(udp_batch &batch, int flags = 0) {
+		batch.prepare_recv();
+		int n;
+		do {
+			n = ::recvmmsg(this->sockfd, batch.msgs.data(), (unsigned)batch.msgs.size(), flags, nullptr);
+		} while (n < 0 && errno == EINTR);
+		if (n > 0) batch.used = (::size_t)n;
+		return n;
+	}
+
+	/**
+	 * @brief send the pending messages of batch with sendmmsg
+	 * @details
+	 *		Keeps calling until every message is out or the socket would block;
+	 *	a later call goes on with the rest. GSO messages fail with EIO when the
+	 *	device cannot segment them.
+	 * @return (int)
+	 *		Messages sent by this call. When none was sent -1 is returned,
+	 *	and errno is set appropriately.
+	 */
+	int send_batch(udp_batch &batch, int flags = 0) {
+		int total = 0;
+		while (batch.sent < batch.used) {
+			int n = ::sendmmsg(this->sockfd, batch.msgs.data() + batch.sent, (unsigned)(batch.used - batch.sent), flags);
+			if (n < 0) {
+				if (errno == EINTR) continue;
+				if (total != 0) break;
+				return -1;
+			}
+			batch.sent += (::size_t)n;
+			total += n;
+		}
+		return total;
+	}
+
+	int close() override {
+		if (is_sockfd_open()) return ::close(sockfd);
+		return 0;
+	}
+};
+
+/**
+ * @brief MSG_ZEROCOPY sends of large in-memory buffers
+ * @details
+ *		send() pins the pages of buf and hands them to the kernel instead of
+ *	copying, so buf has to stay untouched until the kernel is done with it.
+ *	The kernel reports that on the error queue of the socket; epoll flags it
+ *	as EPOLLERR and Cgo::event_loop calls on_errqueue. poll() reads the reports
+ *	and runs the release callback of every completed send, in send order.
+ *		Pinning costs more than copying a small buffer, so below threshold or
+ *	before enable() send() is a plain send and release runs at once. Over
+ *	loopback the kernel copies anyway, copied() counts such sends.
+ */
+class zerocopy_sender {
+	struct pending_t {
+		uint32_t id;
+		std::function<void()> release;
+	};
+public:
+
+	/**
+	 * @param fd (int) connected TCP socket, not owned
+	 * @param threshold (::size_t) smallest buffer sent with MSG_ZEROCOPY
+	 */
+	explicit zerocopy_sender(int fd, ::size_t threshold = 16384) :
+		sockfd(fd), threshold(threshold), enabled(false), next_id(0), acked(0), copied_count(0)
+	{}
+
+	/**
+	 * @brief turn on SO_ZEROCOPY for the socket, needs Linux 4.14
+	 * @return (int)
+	 *		On success, zero is returned. On error, -1 is returned, errno is set
+	 *	appropriately and send() keeps copying.
+	 */
+	int enable() {
+		int one = 1;
+		int ret = ::setsockopt(this->sockfd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one));
+		this->enabled = (ret == 0);
+		return ret;
+	}
+
+	/**
+	 * @brief send buf, releasing it once the kernel no longer reads it
+	 * @param buf (const void *) data, untouched until release runs
+	 * @param len (::size_t) bytes of buf
+	 * @param release (std::function<void()>) runs from send() or poll() when
+	 *	the bytes this call sent are done with. It does not run on error.
+	 * @param flags (int) more send flags, MSG_NOSIGNAL is always added
+	 * @return (::ssize_t)
+	 *		Bytes sent, maybe less than len, as ::send. On error -1 is returned
+	 *	and errno is set appropriately; ENOBUFS means too many pages are pinned,
+	 *	call poll() and retry.
+	 */
+	::ssize_t send(const void *buf, ::size_t len, std::function<void()> release, int flags = 0) {
+		if (!this->enabled || len < this->threshold) {
+			::ssize_t n = ::send(this->sockfd, buf, len, flags | MSG_NOSIGNAL);
+			if (n >= 0 && release) release();
+			return n;
+		}
+		::ssize_t n = ::send(this->sockfd, buf, len, flags | MSG_NOSIGNAL | MSG_ZEROCOPY);
+		if (n < 0) return -1;
+		// the kernel numbers every call that sent something
+		if (n > 0) this->pending.push_back(pending_t{this->next_id++, std::move(release)});
+		else if (release) release();
+		return n;
+	}
+
+	/**
+	 * @brief read the completion reports from the error queue
+	 * @return (int) number of release callbacks run
+	 */
+	int poll() {
+		for (;;) {
+			char control[128];
+			struct msghdr msg = {};
+			msg.msg_control = control;
+			msg.msg_controllen = sizeof(control);
+			if (::recvmsg(this->sockfd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+				if (errno == EINTR) continue;
+				break;
+			}
+			for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != nullptr; cm = CMSG_NXTHDR(&msg, cm)) {
+				if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) &&
+					!(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)) continue;
+				struct sock_extended_err err;
+				::memcpy(&err, CMSG_DATA(cm), sizeof(err));
+				if (err.ee_origin != SO_EE_ORIGIN_ZEROCOPY || err.ee_errno != 0) continue;
+				if (err.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) this->copied_count += err.ee_data - err.ee_info + 1;
+				this->complete(err.ee_info, err.ee_data);
+			}
+		}
+		int released = 0;
+		while (!this->pending.empty() && (int32_t)(this->pending.front().id - this->acked) < 0) {
+			std::function<void()> release = std::move(this->pending.front().release);
+			this->pending.pop_front();
+			if (release) release();
+			released += 1;
+		}
+		return released;
+	}
+
+	/**
+	 * @brief sends whose buffers the kernel still holds
+	 */
+	::size_t outstanding() const {
+		return this->pending.size();
+	}
+
+	/**
+	 * @brief zero-copy sends the kernel still had to copy
+	 */
+	uint64_t copied() const {
+		return this->copied_count;
+	}
+
+private:
+
+	/**
+	 * @brief mark ids lo..hi done, the reports may come out of order
+	 */
+	void complete(uint32_t lo, uint32_t hi) {
+		if (lo != this->acked) {
+			this->early.emplace_back(lo, hi);
+			return ;
+		}
+		this->acked = hi + 1;
+		for (bool moved = true; moved; ) {
+			moved = false;
+			for (::size_t i = 0; i < this->early.size(); ++i) {
+				if (this->early[i].first != this->acked) continue;
+				this->acked = this->early[i].second + 1;
+				this->early.erase(this->early.begin() + i);
+				moved = true;
+				break;
+			}
+		}
+		return ;
+	}
+
+	int sockfd;
+	::size_t threshold;
+	bool enabled;
+	uint32_t next_id;
+	uint32_t acked;
+	uint64_t copied_count;
+	std::deque<pending_t> pending;
+	std::vector<std::pair<uint32_t, uint32_t>> early;
+};
+
 __NAMESPACE_Cgo_END__
 
 // DATE: 2024-08-14
@@ -0,0 +1,209 @@
+/*************************************************************************
+	> File Name: Cgo-TaskGraph.h
+	> Author:Royi
+	> Mail:royi990001@gmail.com
+	> Describe: dependency graph of tasks executed on Cgo::thread_pool
+************************************************************************/
+#ifndef _TASK_GRAPH_H__
+#define _TASK_GRAPH_H__
+
+#include "Cgo-ThreadPool.h"
+
+#include <deque>
+#include <stdexcept>
+#include <initializer_list>
+
+__NAMESPACE_Cgo_BEGIN__
+
+/*************************************************************************
+* > Class Name: task_graph
+* > Father class: none
+* > Describe: DAG of nodes, a node runs once all the nodes it depends on
+            finished. Build the graph once and run() it as often as
+            needed: a run only resets one counter per node and allocates
+            nothing. When a node finishes, the first successor it made
+            ready runs right away on the same worker; further ready
+            successors go to the pool where idle workers pick them up.
+            One graph must not be run by two threads at the same time.
+ ************************************************************************/
+class task_graph {
+public:
+    using node_id = size_t;
+
+private:
+    using func_t = std::function<void()>;
+
+    struct node_t {
+        func_t fn;                                          // body of the node
+        std::vector<node_id> succ;                          // nodes waiting for this one
+        int preds = 0;                                      // number of nodes this one waits for
+        std::atomic<int> pending{ 0 };                      // predecessors left in the current run
+    };
+
+    struct run_t {
+        task_graph *graph;
+        node_id id;
+
+        void operator()() const {
+            graph->execute(id);
+            return ;
+        }
+    };
+
+    static constexpr node_id _none = (node_id)-1;
+
+public:
+
+    /*************************************************************************
+    * > class task_graph
+    * > name : constructor
+     ************************************************************************/
+    task_graph() : _pool(nullptr), _failed(false), _checked(true) {}
+
+    task_graph(const task_graph &) = delete;
+    task_graph &operator=(const task_graph &) = delete;
+
+    /*************************************************************************
+    * > class task_graph
+    * > name : add
+    * > Describe: : add a node running fn, after every node in deps
+     ************************************************************************/
+    template <typename FUNC_T>
+    node_id add(FUNC_T fn, std::initializer_list<node_id> deps = {}) {
+        node_id id = _nodes.size();
+        _nodes.emplace_back();
+        _nodes.back().fn = func_t(std::move(fn));
+        _checked = false;
+        for (node_id d : deps) this->depend(id, d);
+        return id;
+    }
+
+    /*************************************************************************
+    * > class task_graph
+    * > name : depend
+    * > Describe: : node runs only after on finished
+     ************************************************************************/
+    void depend(node_id node, node_id on) {
+        if (node >= _nodes.size() || on >= _nodes.size()) {
+            throw std::out_of_range("task_graph::depend: unknown node");
+        }
+        _nodes[on].succ.push_back(node);
+        _nodes[node].preds += 1;
+        _checked = false;
+        return ;
+    }
+
+    /*************************************************************************
+    * > class task_graph
+    * > name : size
+    * > Describe: : number of nodes
+     ************************************************************************/
+    size_t size() const {
+        return _nodes.size();
+    }
+
+    /*************************************************************************
+    * > class task_graph
+    * > name : run
+    * > Describe: : run every node on pool and return when all finished.
+    *               The calling thread helps with queued tasks meanwhile.
+    *               After a node threw, nodes not started yet are skipped
+    *               and the first exception is rethrown here.
+    *               Throws std::logic_error if the graph has a cycle.
+    *               Nodes bypass the capacity of a bounded pool, a graph
+    *               is admitted as a whole.
+     ************************************************************************/
+    void run(thread_pool &pool) {
+        if (!_checked) this->check();
+        if (_nodes.empty()) return ;
+        _pool = &pool;
+        _failed.store(false, std::memory_order_relaxed);
+        for (auto &n : _nodes) n.pending.store(n.preds, std::memory_order_relaxed);
+        _wg.add((long)_nodes.size());
+        for (node_id id : _roots) pool.spawn(run_t{ this, id });
+        pool.wait(_wg);
+        return ;
+    }
+
+private:
+
+    /*************************************************************************
+    * > class task_graph
+    * > name : check
+    * > Describe: : collect the roots and make sure every node is reachable
+    *               from them, which fails only for cycles
+     ************************************************************************/
+    void check() {
+        _roots.clear();
+        std::vector<int> left(_nodes.size());
+        std::vector<node_id> ready;
+        for (node_id i = 0; i < _nodes.size(); ++i) {
+            left[i] = _nodes[i].preds;
+            if (left[i] == 0) {
+                _roots.push_back(i);
+                ready.push_back(i);
+            }
+        }
+        size_t seen = 0;
+        while (!ready.empty()) {
+            node_id i = ready.back();
+            ready.pop_back();
+            seen += 1;
+            for (node_id s : _nodes[i].succ) {
+                if (--left[s] == 0) ready.push_back(s);
+            }
+        }
+        if (seen != _nodes.size()) throw std::logic_error("task_graph::run: graph has a cycle");
+        _checked = true;
+        return ;
+    }
+
+    /*************************************************************************
+    * > class task_graph
+    * > name : execute
+    * > Describe: : run node id, then release its successors. The group is
+    *               marked done only after the successors are released, so
+    *               run() cannot return while this node still uses the graph.
+     ************************************************************************/
+    void execute(node_id id) {
+        while (id != _none) {
+            node_t &n = _nodes[id];
+            if (!_failed.load(std::memory_order_relaxed)) {
+                try {
+                    n.fn();
+                } catch (...) {
+                    _failed.store(true, std::memory_order_relaxed);
+                    _wg.fail(std::current_exception());
+                }
+            }
+            node_id next = _none;
+            for (node_id s : n.succ) {
+                if (_nodes[s].pending.fetch_sub(1, std::memory_order_acq_rel) != 1) continue;
+                if (next == _none) {
+                    next = s;
+                } else {
+                    _pool->spawn(run_t{ this, s });
+                }
+            }
+            _wg.done();
+            id = next;
+        }
+        return ;
+    }
+
+    std::deque<node_t> _nodes;                              // nodes, never moved once added
+    std::vector<node_id> _roots;                            // nodes without dependencies
+    thread_pool *_pool;                                     // pool of the current run
+    std::atomic<bool> _failed;                              // a node of the current run threw
+    bool _checked;                                          // _roots is up to date, no cycle
+    wait_group _wg;                                         // nodes left in the current run
+};
+
+__NAMESPACE_Cgo_END__
+
+// DATE: 2024-08-03
+// FILENAME: task_graph.h
+// AUTHOR: royi
+// END:
+
+#endif
@@ -0,0 +1,330 @@
+/*************************************************************************
+	> File Name: Cgo-ThreadPool-Bench.cpp
+	> Author:Royi
+	> Mail:royi990001@gmail.com
+	> Describe: benchmarks of Cgo::thread_pool.
+	            build: g++ -std=c++17 -O2 -pthread -I. Cgo-ThreadPool-Bench.cpp -o thread_pool_bench
+	            run:   ./thread_pool_bench [--threads=1,2,4] [--tasks=N] [--mode=shared|stealing|all]
+	                                       [--filter=name] [--baseline]
+	            Prints one JSON object per line, e.g.
+	            {"bench":"throughput_empty","impl":"pool","mode":"work_stealing","threads":4,...}
+************************************************************************/
+#include "Cgo-ThreadPool.h"
+
+#include <cstdio>
+#include <cinttypes>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+namespace {
+
+using bench_clock_t = std::chrono::steady_clock;
+
+/*************************************************************************
+* > Struct Name: bench_config
+* > Describe: command line of the benchmark
+ ************************************************************************/
+struct bench_config {
+    std::vector<int> threads;                               // thread counts to run, scaling axis
+    std::vector<Cgo::pool_mode> modes;                      // pool modes to run
+    long tasks = 1000000;                                   // tasks per throughput run
+    std::string filter;                                     // run only benches containing this
+    bool baseline = false;                                  // also run tasks directly on threads
+};
+
+/*************************************************************************
+* > Struct Name: bench_result
+* > Describe: one output line
+ ************************************************************************/
+struct bench_result {
+    const char *bench = "";
+    const char *impl = "pool";
+    const char *mode = "";
+    int threads = 0;
+    long ops = 0;                                           // tasks run
+    double seconds = 0;                                     // wall time of the measured part
+    std::vector<std::pair<const char *, uint64_t>> extra;   // latency percentiles and such
+};
+
+uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(bench_clock_t::now().time_since_epoch()).count();
+}
+
+const char *mode_name(Cgo::pool_mode mode) {
+    return mode == Cgo::pool_mode::work_stealing ? "work_stealing" : "shared_queue";
+}
+
+/*************************************************************************
+* > Function Name: print_result
+* > Describe: print r as one JSON line
+ ************************************************************************/
+void print_result(const bench_result &r) {
+    double ns_per_op = r.ops > 0 ? r.seconds * 1e9 / (double)r.ops : 0.0;
+    double mops = r.seconds > 0 ? (double)r.ops / r.seconds / 1e6 : 0.0;
+    std::printf("{\"bench\":\"%s\",\"impl\":\"%s\",\"mode\":\"%s\",\"threads\":%d,\"ops\":%ld,"
+                "\"seconds\":%.6f,\"ns_per_op\":%.1f,\"mops\":%.3f",
+                r.bench, r.impl, r.mode, r.threads, r.ops, r.seconds, ns_per_op, mops);
+    for (auto &e : r.extra) std::printf(",\"%s\":%" PRIu64, e.first, e.second);
+    std::printf("}\n");
+    std::fflush(stdout);
+    return ;
+}
+
+/*************************************************************************
+* > Function Name: small_work
+* > Describe: roughly a hundred nanoseconds of arithmetic
+ ************************************************************************/
+void small_work() {
+    volatile uint64_t x = 1;
+    for (int i = 0; i < 64; ++i) x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+    return ;
+}
+
+/*************************************************************************
+* > Function Name: bench_throughput
+* > Describe: one producer adds tasks tasks, then waits for the pool
+ ************************************************************************/
+template <typename FUNC_T>
+bench_result bench_throughput(const char *name, Cgo::thread_pool &pool, long tasks, FUNC_T fn) {
+    bench_result r;
+    r.bench = name;
+    r.ops = tasks;
+    auto start = bench_clock_t::now();
+    for (long i = 0; i < tasks; ++i) pool.add_task(fn);
+    pool.wait_idle();
+    r.seconds = std::chrono::duration<double>(bench_clock_t::now() - start).count();
+    return r;
+}
+
+/*************************************************************************
+* > Function Name: baseline_throughput
+* > Describe: the same work run in a plain loop on threads threads, the
+*             bound no pool can beat
+ ************************************************************************/
+template <typename FUNC_T>
+bench_result baseline_throughput(const char *name, int threads, long tasks, FUNC_T fn) {
+    bench_result r;
+    r.bench = name;
+    r.impl = "baseline";
+    r.ops = tasks;
+    auto start = bench_clock_t::now();
+    std::vector<std::thread> ts;
+    for (int t = 0; t < threads; ++t) {
+        long n = tasks / threads + (t < tasks % threads ? 1 : 0);
+        ts.emplace_back([n, fn] { for (long i = 0; i < n; ++i) fn(); });
+    }
+    for (auto &t : ts) t.join();
+    r.seconds = std::chrono::duration<double>(bench_clock_t::now() - start).count();
+    return r;
+}
+
+/*************************************************************************
+* > Function Name: bench_latency
+* > Describe: time from add_task to the start of the task. Tasks are
+*             paced so each one finds the pool idle, which includes the
+*             wakeup of a parked or spinning worker.
+ ************************************************************************/
+bench_result bench_latency(Cgo::thread_pool &pool, long samples) {
+    std::vector<uint64_t> lat(samples, 0);
+    bench_result r;
+    r.bench = "submit_latency";
+    r.ops = samples;
+    auto start = bench_clock_t::now();
+    for (long i = 0; i < samples; ++i) {
+        uint64_t t0 = now_ns();
+        uint64_t *slot = &lat[i];
+        pool.add_task([slot, t0] { *slot = now_ns() - t0; });
+        std::this_thread::sleep_for(std::chrono::microseconds(20));
+    }
+    pool.wait_idle();
+    r.seconds = std::chrono::duration<double>(bench_clock_t::now() - start).count();
+    std::sort(lat.begin(), lat.end());
+    auto pct = [&](double p) { return lat[std::min<size_t>(lat.size() - 1, (size_t)(p / 100.0 * lat.size()))]; };
+    r.extra = { { "p50_ns", pct(50) }, { "p90_ns", pct(90) }, { "p99_ns", pct(99) },
+                { "p999_ns", pct(99.9) }, { "max_ns", lat.back() } };
+    return r;
+}
+
+/*************************************************************************
+* > Function Name: bench_producers
+* > Describe: producers threads add tasks at the same time
+ ************************************************************************/
+bench_result bench_producers(Cgo::thread_pool &pool, int producers, long tasks) {
+    bench_result r;
+    r.bench = "contention_producers";
+    r.ops = tasks;
+    std::atomic<bool> go(false);
+    std::vector<std::thread> ts;
+    for (int p = 0; p < producers; ++p) {
+        long n = tasks / producers + (p < tasks % producers ? 1 : 0);
+        ts.emplace_back([&pool, &go, n] {
+            while (!go.load()) std::this_thread::yield();
+            for (long i = 0; i < n; ++i) pool.add_task([] {});
+        });
+    }
+    auto start = bench_clock_t::now();
+    go.store(true);
+    for (auto &t : ts) t.join();
+    pool.wait_idle();
+    r.seconds = std::chrono::duration<double>(bench_clock_t::now() - start).count();
+    r.extra = { { "producers", (uint64_t)producers } };
+    return r;
+}
+
+/*************************************************************************
+* > Function Name: bench_fan_out
+* > Describe: rounds of fan children added from one worker task and
+*             joined with a wait_group, the shape of a parallel stage
+ ************************************************************************/
+bench_result bench_fan_out(Cgo::thread_pool &pool, long rounds, int fan) {
+    bench_result r;
+    r.bench = "fan_out_fan_in";
+    r.ops = rounds * fan;
+    auto start = bench_clock_t::now();
+    Cgo::wait_group outer;
+    pool.submit(outer, [&pool, rounds, fan] {
+        for (long k = 0; k < rounds; ++k) {
+            Cgo::wait_group wg;
+            for (int i = 0; i < fan; ++i) pool.submit(wg, small_work);
+            pool.wait(wg);
+        }
+    });
+    outer.wait();
+    r.seconds = std::chrono::duration<double>(bench_clock_t::now() - start).count();
+    r.extra = { { "fan", (uint64_t)fan } };
+    return r;
+}
+
+/*************************************************************************
+* > Function Name: baseline_fan_out
+* > Describe: the same rounds with one std::thread per child
+ ************************************************************************/
+bench_result baseline_fan_out(long rounds, int fan) {
+    bench_result r;
+    r.bench = "fan_out_fan_in";
+    r.impl = "baseline";
+    r.ops = rounds * fan;
+    auto start = bench_clock_t::now();
+    for (long k = 0; k < rounds; ++k) {
+        std::vector<std::thread> ts;
+        for (int i = 0; i < fan; ++i) ts.emplace_back(small_work);
+        for (auto &t : ts) t.join();
+    }
+    r.seconds = std::chrono::duration<double>(bench_clock_t::now() - start).count();
+    r.extra = { { "fan", (uint64_t)fan } };
+    return r;
+}
+
+std::vector<int> parse_ints(const std::string &s) {
+    std::vector<int> out;
+    size_t pos = 0;
+    while (pos < s.size()) {
+        size_t end = s.find(',', pos);
+        if (end == std::string::npos) end = s.size();
+        int v = std::atoi(s.substr(pos, end - pos).c_str());
+        if (v > 0) out.push_back(v);
+        pos = end + 1;
+    }
+    return out;
+}
+
+/*************************************************************************
+* > Function Name: parse_args
+* > Describe: fill config from argv, unknown options are reported
+ ************************************************************************/
+bool parse_args(int argc, char **argv, bench_config &config) {
+    std::string mode = "all";
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        auto value = [&](const char *key) -> const char * {
+            size_t n = std::strlen(key);
+            return a.compare(0, n, key) == 0 ? a.c_str() + n : nullptr;
+        };
+        if (const char *v = value("--threads=")) {
+            config.threads = parse_ints(v);
+        } else if (const char *v = value("--tasks=")) {
+            config.tasks = std::max(1L, std::atol(v));
+        } else if (const char *v = value("--mode=")) {
+            mode = v;
+        } else if (const char *v = value("--filter=")) {
+            config.filter = v;
+        } else if (a == "--baseline") {
+            config.baseline = true;
+        } else {
+            std::fprintf(stderr, "unknown option %s\n", argv[i]);
+            return false;
+        }
+    }
+    if (config.threads.empty()) {
+        int hw = std::max(1, (int)std::thread::hardware_concurrency());
+        for (int t = 1; t < hw; t *= 2) config.threads.push_back(t);
+        config.threads.push_back(hw);
+    }
+    if (mode == "shared" || mode == "all") config.modes.push_back(Cgo::pool_mode::shared_queue);
+    if (mode == "stealing" || mode == "all") config.modes.push_back(Cgo::pool_mode::work_stealing);
+    if (config.modes.empty()) {
+        std::fprintf(stderr, "unknown mode %s\n", mode.c_str());
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    bench_config config;
+    if (!parse_args(argc, argv, config)) return 2;
+    auto wanted = [&](const char *name) {
+        return config.filter.empty() || std::string(name).find(config.filter) != std::string::npos;
+    };
+    long fan_rounds = std::max(1L, config.tasks / 1000);
+    for (int threads : config.threads) {
+        for (Cgo::pool_mode mode : config.modes) {
+            Cgo::thread_pool pool(threads, mode);
+            std::vector<bench_result> results;
+            if (wanted("throughput_empty")) {
+                results.push_back(bench_throughput("throughput_empty", pool, config.tasks, [] {}));
+            }
+            if (wanted("throughput_small")) {
+                results.push_back(bench_throughput("throughput_small", pool, config.tasks, small_work));
+            }
+            if (wanted("submit_latency")) {
+                results.push_back(bench_latency(pool, std::min(config.tasks, 20000L)));
+            }
+            if (wanted("contention_producers")) {
+                results.push_back(bench_producers(pool, std::max(4, threads * 2), config.tasks));
+            }
+            if (wanted("fan_out_fan_in")) {
+                results.push_back(bench_fan_out(pool, fan_rounds, 64));
+            }
+            for (auto &r : results) {
+                r.mode = mode_name(mode);
+                r.threads = threads;
+                print_result(r);
+            }
+        }
+        if (!config.baseline) continue;
+        std::vector<bench_result> results;
+        if (wanted("throughput_empty")) {
+            results.push_back(baseline_throughput("throughput_empty", threads, config.tasks, [] {}));
+        }
+        if (wanted("throughput_small")) {
+            results.push_back(baseline_throughput("throughput_small", threads, config.tasks, small_work));
+        }
+        if (wanted("fan_out_fan_in")) {
+            results.push_back(baseline_fan_out(std::max(1L, fan_rounds / 10), 64));
+        }
+        for (auto &r : results) {
+            r.mode = "none";
+            r.threads = threads;
+            print_result(r);
+        }
+    }
+    return 0;
+}
+
+// DATE: 2024-08-03
+// FILENAME: thread_pool_bench.cpp
+// AUTHOR: royi
+// END:
@@ -12,104 +12,2225 @@
 #define __NAMESPACE_Cgo_END__  }  
 
 #include <queue>
+#include <deque>
+#include <memory>
+#include <atomic>
 #include <vector>
-#include <unordered_map>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
 #include <functional>
+#include <iterator>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <fstream>
+#include <cstdlib>
+#include <cstring>
+#include <sched.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <future>
+#include <exception>
+#include <type_traits>
+#include <tuple>
+#include <new>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+
+#include "Cgo-TimerWheel.h"
+#include "Cgo-Trace.h"
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <coroutine>
+#define __Cgo_COROUTINE__ 1
+#endif
 
 __NAMESPACE_Cgo_BEGIN__
 
-/*************************************************************************
-* > Class Name: task
-* > Father class: none
-* > Describe: Standardize binding of different functions and the different
-            parameters (including types and numbers) required by the 
-            function as tasks to be executed in a thread pool.
- ************************************************************************/
-class task {
-    using self = task;
-    using func_t = std::function<void()>;
+/*************************************************************************
+* > Class Name: task_allocator
+* > Father class: none
+* > Describe: Slab allocator for callables too large to be stored inline
+            in a task. Blocks of 64 to 512 bytes are carved from 64 KiB
+            chunks and never returned to malloc before the allocator dies.
+            Each worker keeps a small cache per size class, so a block
+            freed by one worker is reused by the next large task without
+            taking the central lock.
+ ************************************************************************/
+class task_allocator {
+    using mutex_t = std::mutex;
+
+    struct block_t {
+        block_t *next;
+    };
+
+public:
+
+    static constexpr size_t _classes = 4;                  // 64, 128, 256, 512 bytes
+    static constexpr size_t _align = 64;                   // alignment of every block
+    static constexpr size_t _chunk_size = 64 * 1024;       // bytes carved at once
+    static constexpr size_t _cache_max = 64;               // blocks one worker keeps per class
+
+    /*************************************************************************
+    * > Struct Name: cache_t
+    * > Describe: blocks owned by one thread, only touched by that thread
+     ************************************************************************/
+    struct cache_t {
+        task_allocator *owner = nullptr;
+        block_t *free[_classes] = {};
+        size_t count[_classes] = {};
+    };
+
+    /*************************************************************************
+    * > Function Name: this_cache
+    * > From class: task_allocator
+    * > Describe: cache of the calling thread, nullptr outside workers
+     ************************************************************************/
+    static cache_t *&this_cache() {
+        static thread_local cache_t *c = nullptr;
+        return c;
+    }
+
+    task_allocator() = default;
+    task_allocator(const task_allocator &) = delete;
+    task_allocator &operator=(const task_allocator &) = delete;
+
+    ~task_allocator() {
+        for (auto c : _chunks) ::operator delete(c, std::align_val_t(_align));
+    }
+
+    /*************************************************************************
+    * > Function Name: allocate
+    * > From class: task_allocator
+    * > Describe: get a 64 byte aligned block of at least size bytes
+     ************************************************************************/
+    void *allocate(size_t size) {
+        size_t cls = class_of(size);
+        if (cls == _classes) {
+            void *p = ::operator new(size, std::align_val_t(_align));
+            _large.fetch_add(size, std::memory_order_relaxed);
+            return p;
+        }
+        cache_t *c = this_cache();
+        if (c != nullptr && c->owner == this) {
+            if (c->free[cls] == nullptr) this->refill(c, cls);
+            block_t *b = c->free[cls];
+            c->free[cls] = b->next;
+            c->count[cls] -= 1;
+            return b;
+        }
+        std::unique_lock<std::mutex> locker(m_mutex);
+        if (_free[cls] == nullptr) this->carve(cls);
+        block_t *b = _free[cls];
+        _free[cls] = b->next;
+        return b;
+    }
+
+    /*************************************************************************
+    * > Function Name: deallocate
+    * > From class: task_allocator
+    * > Describe: give back a block, size must match allocate()
+     ************************************************************************/
+    void deallocate(void *p, size_t size) {
+        size_t cls = class_of(size);
+        if (cls == _classes) {
+            ::operator delete(p, std::align_val_t(_align));
+            _large.fetch_sub(size, std::memory_order_relaxed);
+            return ;
+        }
+        block_t *b = static_cast<block_t *>(p);
+        cache_t *c = this_cache();
+        if (c != nullptr && c->owner == this) {
+            b->next = c->free[cls];
+            c->free[cls] = b;
+            if (++c->count[cls] > _cache_max) this->flush(c, cls, _cache_max / 2);
+            return ;
+        }
+        std::unique_lock<std::mutex> locker(m_mutex);
+        b->next = _free[cls];
+        _free[cls] = b;
+        return ;
+    }
+
+    /*************************************************************************
+    * > Function Name: release
+    * > From class: task_allocator
+    * > Describe: move every block of a cache back to the central lists
+     ************************************************************************/
+    void release(cache_t *c) {
+        for (size_t cls = 0; cls < _classes; ++cls) {
+            this->flush(c, cls, c->count[cls]);
+        }
+        return ;
+    }
+
+    /*************************************************************************
+    * > Function Name: slab_bytes
+    * > From class: task_allocator
+    * > Describe: bytes held in chunks, used or free
+     ************************************************************************/
+    size_t slab_bytes() {
+        std::unique_lock<std::mutex> locker(m_mutex);
+        return _chunks.size() * _chunk_size;
+    }
+
+    /*************************************************************************
+    * > Function Name: large_bytes
+    * > From class: task_allocator
+    * > Describe: bytes of live blocks too large for a size class
+     ************************************************************************/
+    size_t large_bytes() const {
+        return _large.load(std::memory_order_relaxed);
+    }
+
+private:
+
+    mutex_t m_mutex;                                        // mutex for central lists
+    block_t *_free[_classes] = {};                          // central free lists
+    std::vector<void *> _chunks;                            // every chunk carved so far
+    std::atomic<size_t> _large{ 0 };                        // bytes taken from the heap directly
+
+    static size_t class_of(size_t size) {
+        size_t cls = 0;
+        while (cls < _classes && (size_t(64) << cls) < size) ++cls;
+        return cls;
+    }
+
+    // called with m_mutex held
+    void carve(size_t cls) {
+        size_t block = size_t(64) << cls;
+        char *chunk = static_cast<char *>(::operator new(_chunk_size, std::align_val_t(_align)));
+        _chunks.push_back(chunk);
+        for (size_t off = 0; off + block <= _chunk_size; off += block) {
+            block_t *b = reinterpret_cast<block_t *>(chunk + off);
+            b->next = _free[cls];
+            _free[cls] = b;
+        }
+        return ;
+    }
+
+    void refill(cache_t *c, size_t cls) {
+        std::unique_lock<std::mutex> locker(m_mutex);
+        if (_free[cls] == nullptr) this->carve(cls);
+        for (size_t i = 0; i < _cache_max / 2 && _free[cls] != nullptr; ++i) {
+            block_t *b = _free[cls];
+            _free[cls] = b->next;
+            b->next = c->free[cls];
+            c->free[cls] = b;
+            c->count[cls] += 1;
+        }
+        return ;
+    }
+
+    void flush(cache_t *c, size_t cls, size_t n) {
+        if (n == 0) return ;
+        std::unique_lock<std::mutex> locker(m_mutex);
+        for (size_t i = 0; i < n && c->free[cls] != nullptr; ++i) {
+            block_t *b = c->free[cls];
+            c->free[cls] = b->next;
+            c->count[cls] -= 1;
+            b->next = _free[cls];
+            _free[cls] = b;
+        }
+        return ;
+    }
+};
+
+/*************************************************************************
+* > Class Name: task
+* > Father class: none
+* > Describe: Standardize binding of different functions and the different
+            parameters (including types and numbers) required by the 
+            function as tasks to be executed in a thread pool.
+            The task is move only. Callables up to 48 bytes are stored
+            inline, larger ones in a block of a task_allocator (or the
+            heap when no allocator is given). Besides the callable a
+            task only carries its enqueue time for pool metrics and
+            whether a full pool may drop it.
+ ************************************************************************/
+class task {
+    using self = task;
+
+    static constexpr size_t _inline_size = 48;             // bytes of inline storage
+
+    /*************************************************************************
+    * > Struct Name: ops_t
+    * > Describe: type erased operations on the stored callable
+     ************************************************************************/
+    struct ops_t {
+        void (*run)(self &);
+        void (*move)(self &, self &);                       // move storage of src into dst, src is left empty
+        void (*destroy)(self &);
+    };
+
+    template <typename FUNC_T, typename ...ARGS>
+    struct bound_t {
+        std::tuple<FUNC_T, ARGS...> _call;
+        void operator()() {
+            std::apply([](auto &...call) { std::invoke(call...); }, _call);
+            return ;
+        }
+    };
+
+    template <typename CALL_T>
+    static constexpr bool fits_inline() {
+        return sizeof(CALL_T) <= _inline_size
+            && alignof(CALL_T) <= alignof(std::max_align_t)
+            && std::is_nothrow_move_constructible<CALL_T>::value;
+    }
+
+    template <typename CALL_T>
+    struct inline_ops {
+        static CALL_T *get(self &t) {
+            return std::launder(reinterpret_cast<CALL_T *>(t._buf));
+        }
+        static void run(self &t) {
+            (*get(t))();
+            return ;
+        }
+        static void move(self &dst, self &src) {
+            new (dst._buf) CALL_T(std::move(*get(src)));
+            get(src)->~CALL_T();
+            return ;
+        }
+        static void destroy(self &t) {
+            get(t)->~CALL_T();
+            return ;
+        }
+        static constexpr ops_t table = { &run, &move, &destroy };
+    };
+
+    template <typename CALL_T>
+    struct heap_ops {
+        struct ref_t {
+            CALL_T *call;
+            task_allocator *alloc;                          // owner of the block, nullptr for the heap
+        };
+        static ref_t &get(self &t) {
+            return *std::launder(reinterpret_cast<ref_t *>(t._buf));
+        }
+        static void run(self &t) {
+            (*get(t).call)();
+            return ;
+        }
+        static void move(self &dst, self &src) {
+            new (dst._buf) ref_t(get(src));
+            return ;
+        }
+        static void destroy(self &t) {
+            ref_t &ref = get(t);
+            ref.call->~CALL_T();
+            if (ref.alloc != nullptr) {
+                ref.alloc->deallocate(ref.call, sizeof(CALL_T));
+            } else {
+                ::operator delete(ref.call, std::align_val_t(alignof(CALL_T)));
+            }
+            return ;
+        }
+        static constexpr ops_t table = { &run, &move, &destroy };
+    };
+
+public:
+
+    /*************************************************************************
+    * > class task 
+    * > name : constructor 
+    * > Describe: : empty task
+    ************************************************************************/
+    task() : _ops(nullptr), _stamp(0) {}
+
+    /*************************************************************************
+    * > class task 
+    * > name : constructor 
+    ************************************************************************/
+    template <typename FUNC_T, typename ...ARGS,
+              typename = typename std::enable_if<!std::is_same<typename std::decay<FUNC_T>::type, self>::value>::type>
+    task(FUNC_T func, ARGS... args) :
+        task(std::allocator_arg, static_cast<task_allocator *>(nullptr), std::move(func), std::forward<ARGS> (args)...)
+    {}
+
+    /*************************************************************************
+    * > class task 
+    * > name : constructor 
+    * > Describe: : large callables are stored in a block of alloc
+    ************************************************************************/
+    template <typename FUNC_T, typename ...ARGS>
+    task(std::allocator_arg_t, task_allocator *alloc, FUNC_T func, ARGS... args) : _stamp(0) {
+        using call_t = bound_t<FUNC_T, ARGS...>;
+        if constexpr (fits_inline<call_t>()) {
+            new (_buf) call_t{ std::tuple<FUNC_T, ARGS...>(std::move(func), std::forward<ARGS> (args)...) };
+            _ops = &inline_ops<call_t>::table;
+        } else {
+            using ref_t = typename heap_ops<call_t>::ref_t;
+            void *p = nullptr;
+            if (alignof(call_t) > task_allocator::_align) alloc = nullptr;
+            if (alloc != nullptr) {
+                p = alloc->allocate(sizeof(call_t));
+            } else {
+                p = ::operator new(sizeof(call_t), std::align_val_t(alignof(call_t)));
+            }
+            call_t *call = new (p) call_t{ std::tuple<FUNC_T, ARGS...>(std::move(func), std::forward<ARGS> (args)...) };
+            new (_buf) ref_t{ call, alloc };
+            _ops = &heap_ops<call_t>::table;
+        }
+    }
+
+    task(const self &) = delete;
+    self &operator=(const self &) = delete;
+
+    task(self &&other) noexcept : _ops(other._ops), _stamp(other._stamp) {
+        if (_ops != nullptr) _ops->move(*this, other);
+        other._ops = nullptr;
+    }
+
+    self &operator=(self &&other) noexcept {
+        if (this == &other) return *this;
+        this->clear();
+        _ops = other._ops;
+        _stamp = other._stamp;
+        if (_ops != nullptr) _ops->move(*this, other);
+        other._ops = nullptr;
+        return *this;
+    }
+
+    /*************************************************************************
+    * > class ~task 
+    * > name : destructor 
+     ************************************************************************/
+    ~task() {
+        this->clear();
+    }
+
+    /*************************************************************************
+    * > class task 
+    * > name : run 
+    * > Describe: : run the task
+     ************************************************************************/
+    void run() {
+        _ops->run(*this);
+        return ;
+    }
+
+    /*************************************************************************
+    * > class task 
+    * > name : clear 
+    * > Describe: : destroy the stored callable, the task becomes empty
+     ************************************************************************/
+    void clear() {
+        if (_ops != nullptr) {
+            _ops->destroy(*this);
+            _ops = nullptr;
+        }
+        return ;
+    }
+
+    explicit operator bool() const {
+        return _ops != nullptr;
+    }
+
+    /*************************************************************************
+    * > class task 
+    * > name : stamp 
+    * > Describe: : steady_clock nanoseconds when the task was queued, 0 when
+    *               the pool does not collect metrics
+     ************************************************************************/
+    uint64_t stamp() const {
+        return _stamp & ~_pinned;
+    }
+
+    void set_stamp(uint64_t ns) {
+        _stamp = (_stamp & _pinned) | (ns & ~_pinned);
+        return ;
+    }
+
+    /*************************************************************************
+    * > class task 
+    * > name : pinned 
+    * > Describe: : a pinned task continues work already accepted, such as a
+    *               coroutine resume, and is never dropped by overflow_policy
+     ************************************************************************/
+    bool pinned() const {
+        return (_stamp & _pinned) != 0;
+    }
+
+    void set_pinned() {
+        _stamp |= _pinned;
+        return ;
+    }
+
+private:
+    static constexpr uint64_t _pinned = uint64_t(1) << 63;  // flag bit kept in _stamp
+
+    const ops_t *_ops;                                      // nullptr when empty
+    uint64_t _stamp;                                        // enqueue time in ns, 0 if unknown, top bit pinned
+    alignas(std::max_align_t) unsigned char _buf[_inline_size];
+};
+
+/*************************************************************************
+* > Class Name: wait_group
+* > Father class: none
+* > Describe: Completion counter for a group of tasks. Counting is done
+            with one atomic, only the last done() takes the mutex, so
+            waiting on millions of tasks needs no allocation per task.
+            The first exception thrown by a task of the group is kept
+            and rethrown by wait().
+ ************************************************************************/
+class wait_group {
+    using mutex_t = std::mutex;
+    using cond_t = std::condition_variable;
+
+public:
+
+    /*************************************************************************
+    * > class wait_group 
+    * > name : constructor
+     ************************************************************************/
+    wait_group() : _count(0) {}
+
+    wait_group(const wait_group &) = delete;
+    wait_group &operator=(const wait_group &) = delete;
+
+    /*************************************************************************
+    * > class wait_group 
+    * > name : add
+    * > Describe: : expect n more calls of done()
+     ************************************************************************/
+    void add(long n = 1) {
+        _count.fetch_add(n);
+        return ;
+    }
+
+    /*************************************************************************
+    * > class wait_group 
+    * > name : done
+    * > Describe: : mark one task finished. The decrement to zero happens
+    *               under m_mutex, so wait() cannot return and destroy the
+    *               group while the last done() still uses it.
+     ************************************************************************/
+    void done() {
+        long c = _count.load(std::memory_order_relaxed);
+        while (c > 1) {
+            if (_count.compare_exchange_weak(c, c - 1, std::memory_order_acq_rel)) return ;
+        }
+        std::unique_lock<std::mutex> locker(m_mutex);
+        if (_count.fetch_sub(1) == 1) m_cond.notify_all();
+        return ;
+    }
+
+    /*************************************************************************
+    * > class wait_group 
+    * > name : fail
+    * > Describe: : keep the first exception of the group
+     ************************************************************************/
+    void fail(std::exception_ptr e) {
+        std::unique_lock<std::mutex> locker(m_mutex);
+        if (!_error) _error = e;
+        return ;
+    }
+
+    /*************************************************************************
+    * > class wait_group 
+    * > name : wait
+    * > Describe: : block until the counter drops to zero, then rethrow the
+    *               first exception of the group if there is one
+     ************************************************************************/
+    void wait() {
+        std::unique_lock<std::mutex> locker(m_mutex);
+        while (_count.load() > 0) {
+            m_cond.wait(locker);
+        }
+        if (_error) {
+            std::exception_ptr e = _error;
+            _error = nullptr;
+            std::rethrow_exception(e);
+        }
+        return ;
+    }
+
+    /*************************************************************************
+    * > class wait_group 
+    * > name : pending
+    * > Describe: : number of unfinished tasks
+     ************************************************************************/
+    long pending() const {
+        return _count.load();
+    }
+
+private:
+    std::atomic<long> _count;                               // unfinished tasks
+    mutex_t m_mutex;                                        // mutex for last done() and wait()
+    cond_t m_cond;                                          // condition variable for wait()
+    std::exception_ptr _error;                              // first exception of the group
+};
+
+/*************************************************************************
+* > Class Name: mpmc_queue
+* > Father class: none
+* > Describe: Bounded lock free multi producer / multi consumer ring.
+            Every slot carries a sequence number telling whether it is
+            free for the producer of this lap or filled for the consumer
+            of this lap, so producers and consumers only contend on the
+            head and tail counters, which live on their own cache lines.
+ ************************************************************************/
+template <typename T>
+class mpmc_queue {
+    using self = mpmc_queue<T>;
+
+    struct cell_t {
+        std::atomic<size_t> seq;                            // lap the slot is ready for
+        T data;
+    };
+
+public:
+
+    /*************************************************************************
+    * > class mpmc_queue 
+    * > name : constructor 
+    * > Describe: : capacity is rounded up to a power of two
+     ************************************************************************/
+    explicit mpmc_queue(size_t capacity) : _head(0), _tail(0) {
+        size_t size = 2;
+        while (size < capacity) size <<= 1;
+        _mask = size - 1;
+        _cells.reset(new cell_t[size]);
+        for (size_t i = 0; i < size; ++i) {
+            _cells[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    mpmc_queue(const self &) = delete;
+    self &operator=(const self &) = delete;
+
+    /*************************************************************************
+    * > class mpmc_queue 
+    * > name : try_push 
+    * > Describe: : return false when the ring is full, v is untouched then
+     ************************************************************************/
+    bool try_push(T &&v) {
+        size_t pos = _head.load(std::memory_order_relaxed);
+        cell_t *cell;
+        for (;;) {
+            cell = &_cells[pos & _mask];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+            if (dif == 0) {
+                if (_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (dif < 0) {
+                return false;
+            } else {
+                pos = _head.load(std::memory_order_relaxed);
+            }
+        }
+        cell->data = std::move(v);
+        cell->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /*************************************************************************
+    * > class mpmc_queue 
+    * > name : try_pop 
+    * > Describe: : return false when the ring is empty
+     ************************************************************************/
+    bool try_pop(T &out) {
+        size_t pos = _tail.load(std::memory_order_relaxed);
+        cell_t *cell;
+        for (;;) {
+            cell = &_cells[pos & _mask];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (dif == 0) {
+                if (_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (dif < 0) {
+                return false;
+            } else {
+                pos = _tail.load(std::memory_order_relaxed);
+            }
+        }
+        out = std::move(cell->data);
+        cell->seq.store(pos + _mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    /*************************************************************************
+    * > class mpmc_queue 
+    * > name : capacity 
+     ************************************************************************/
+    size_t capacity() const {
+        return _mask + 1;
+    }
+
+    size_t bytes() const {
+        return this->capacity() * sizeof(cell_t);
+    }
+
+private:
+    alignas(64) std::atomic<size_t> _head;                  // next slot to fill
+    alignas(64) std::atomic<size_t> _tail;                  // next slot to drain
+    alignas(64) size_t _mask;                               // capacity - 1
+    std::unique_ptr<cell_t[]> _cells;                       // slots
+};
+
+/*************************************************************************
+* > Enum Name: task_priority
+* > Describe: priority level of a task, normal is the default
+ ************************************************************************/
+enum class task_priority {
+    critical,
+    high,
+    normal,
+    low
+};
+
+/*************************************************************************
+* > Struct Name: task_sched
+* > Describe: scheduling request of one task: a priority level and an
+*             optional deadline. Among tasks of the same level the ones
+*             with a deadline run first, earliest deadline first.
+ ************************************************************************/
+struct task_sched {
+    using steady_t = std::chrono::steady_clock;
+
+    task_priority priority;                                 // priority level
+    steady_t::time_point deadline;                           // time_point::max() when there is none
+
+    task_sched(task_priority priority = task_priority::normal) :
+        priority(priority), deadline(steady_t::time_point::max())
+    {}
+
+    task_sched(steady_t::time_point deadline, task_priority priority = task_priority::normal) :
+        priority(priority), deadline(deadline)
+    {}
+
+    /*************************************************************************
+    * > Function Name: within
+    * > From struct: task_sched
+    * > Describe: deadline relative to now
+     ************************************************************************/
+    template <typename REP_T, typename PERIOD_T>
+    static task_sched within(std::chrono::duration<REP_T, PERIOD_T> d, task_priority priority = task_priority::normal) {
+        return task_sched(steady_t::now() + std::chrono::duration_cast<steady_t::duration>(d), priority);
+    }
+
+    bool is_default() const {
+        return priority == task_priority::normal && deadline == steady_t::time_point::max();
+    }
+};
+
+/*************************************************************************
+* > Class Name: priority_task_queue
+* > Father class: none
+* > Describe: Queue for tasks with a non default task_sched. Every level is
+            split in two classes, deadline tasks (a heap ordered by
+            deadline) and plain tasks (fifo), which gives 8 classes
+            ordered by urgency and a bitmask of the non empty ones. Class
+            5, normal tasks without deadline, is kept by the owner of the
+            queue (the thread_pool queues) and only takes part in the
+            choice. Once the most urgent class has won starvation_limit
+            picks in a row while others were waiting, the turn goes round
+            robin to the waiting lower classes.
+ ************************************************************************/
+class priority_task_queue {
+    using mutex_t = std::mutex;
+    using steady_t = std::chrono::steady_clock;
+
+    struct entry_t {
+        steady_t::time_point deadline;
+        uint64_t seq;
+        Cgo::task t;
+    };
+
+    struct later_t {
+        bool operator()(const entry_t &a, const entry_t &b) const {
+            if (a.deadline != b.deadline) return a.deadline > b.deadline;
+            return a.seq > b.seq;
+        }
+    };
+
+public:
+
+    static constexpr int _levels = 4;                      // values of task_priority
+    static constexpr int _outer_class = 5;                 // normal without deadline
+
+    /*************************************************************************
+    * > class priority_task_queue 
+    * > name : constructor 
+     ************************************************************************/
+    explicit priority_task_queue(unsigned starvation_limit = 16) :
+        _mask(0), _seq(0), _streak(0), _limit(starvation_limit), _rotor(0), _size(0)
+    {}
+
+    /*************************************************************************
+    * > class priority_task_queue 
+    * > name : push 
+    * > Describe: : queue t, sched must not be the default one
+     ************************************************************************/
+    void push(const task_sched &sched, Cgo::task &&t) {
+        int cls = class_of(sched);
+        int level = cls / 2;
+        std::unique_lock<std::mutex> locker(m_mutex);
+        if (cls % 2 == 0) {
+            _edf[level].push_back(entry_t{ sched.deadline, _seq++, std::move(t) });
+            std::push_heap(_edf[level].begin(), _edf[level].end(), later_t());
+        } else {
+            _fifo[level].push_back(std::move(t));
+        }
+        _mask |= 1u << cls;
+        _size.fetch_add(1, std::memory_order_relaxed);
+        return ;
+    }
+
+    /*************************************************************************
+    * > class priority_task_queue 
+    * > name : pop 
+    * > Describe: : take the task whose turn it is. outer_waiting tells
+    *               whether class 5 has tasks. Return false when the queue
+    *               is empty or class 5 has the turn.
+     ************************************************************************/
+    bool pop(Cgo::task &out, bool outer_waiting) {
+        std::unique_lock<std::mutex> locker(m_mutex);
+        uint32_t mask = _mask | (outer_waiting ? 1u << _outer_class : 0u);
+        if (_mask == 0) return false;
+        int top = __builtin_ctz(mask);
+        int pick = top;
+        uint32_t lower = mask & ~((2u << top) - 1);
+        if (lower == 0) {
+            _streak = 0;
+        } else if (++_streak > _limit) {
+            _streak = 0;
+            uint32_t after = (_rotor > top) ? (lower & ~((2u << _rotor) - 1)) : lower;
+            pick = __builtin_ctz(after != 0 ? after : lower);
+            _rotor = pick;
+        }
+        if (pick == _outer_class) return false;
+        int level = pick / 2;
+        if (pick % 2 == 0) {
+            std::pop_heap(_edf[level].begin(), _edf[level].end(), later_t());
+            out = std::move(_edf[level].back().t);
+            _edf[level].pop_back();
+            if (_edf[level].empty()) _mask &= ~(1u << pick);
+        } else {
+            out = std::move(_fifo[level].front());
+            _fifo[level].pop_front();
+            if (_fifo[level].empty()) _mask &= ~(1u << pick);
+        }
+        _size.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    /*************************************************************************
+    * > class priority_task_queue
+    * > name : drop
+    * > Describe: : take the least urgent unpinned task of a class after
+    *               above, the oldest of a fifo or the latest deadline of a
+    *               heap. Return false when there is none.
+     ************************************************************************/
+    bool drop(Cgo::task &out, int above) {
+        std::unique_lock<std::mutex> locker(m_mutex);
+        for (int cls = 2 * _levels - 1; cls > above; --cls) {
+            if ((_mask & (1u << cls)) == 0) continue;
+            int level = cls / 2;
+            if (cls % 2 == 0) {
+                auto &heap = _edf[level];
+                auto victim = heap.end();
+                for (auto it = heap.begin(); it != heap.end(); ++it) {
+                    if (it->t.pinned()) continue;
+                    if (victim == heap.end() || later_t()(*it, *victim)) victim = it;
+                }
+                if (victim == heap.end()) continue;
+                out = std::move(victim->t);
+                heap.erase(victim);
+                std::make_heap(heap.begin(), heap.end(), later_t());
+                if (heap.empty()) _mask &= ~(1u << cls);
+            } else {
+                auto &fifo = _fifo[level];
+                auto victim = std::find_if(fifo.begin(), fifo.end(),
+                    [](const Cgo::task &t) { return !t.pinned(); });
+                if (victim == fifo.end()) continue;
+                out = std::move(*victim);
+                fifo.erase(victim);
+                if (fifo.empty()) _mask &= ~(1u << cls);
+            }
+            _size.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+        return false;
+    }
+
+    /*************************************************************************
+    * > class priority_task_queue 
+    * > name : size 
+    * > Describe: : number of queued tasks, may be stale
+     ************************************************************************/
+    long size() const {
+        return _size.load(std::memory_order_relaxed);
+    }
+
+    /*************************************************************************
+    * > class priority_task_queue 
+    * > name : clear 
+    * > Describe: : destroy every queued task
+     ************************************************************************/
+    void clear() {
+        std::unique_lock<std::mutex> locker(m_mutex);
+        for (int i = 0; i < _levels; ++i) {
+            _edf[i].clear();
+            _fifo[i].clear();
+        }
+        _mask = 0;
+        _size.store(0, std::memory_order_relaxed);
+        return ;
+    }
+
+private:
+    mutex_t m_mutex;                                        // mutex for all classes
+    uint32_t _mask;                                         // bit per non empty class
+    std::vector<entry_t> _edf[_levels];                     // deadline heaps, classes 0, 2, 4, 6
+    std::deque<Cgo::task> _fifo[_levels];                   // plain fifos, classes 1, 3, 7
+    uint64_t _seq;                                          // keeps equal deadlines in fifo order
+    unsigned _streak;                                       // picks won in a row by the top class
+    unsigned _limit;                                        // starvation limit
+    int _rotor;                                             // class served by the last starvation turn
+    std::atomic<long> _size;                                // queued tasks
+
+    static int class_of(const task_sched &sched) {
+        int has_deadline = (sched.deadline != steady_t::time_point::max());
+        return 2 * static_cast<int>(sched.priority) + (has_deadline ? 0 : 1);
+    }
+};
+
+/*************************************************************************
+* > Enum Name: pool_mode
+* > Describe: scheduling strategy used by thread_pool
+ ************************************************************************/
+enum class pool_mode {
+    shared_queue,                                           // all workers pull from one queue
+    work_stealing                                           // every worker owns a deque, idle workers steal
+};
+
+/*************************************************************************
+* > Enum Name: overflow_policy
+* > Describe: what add_task does when a bounded thread_pool is full
+ ************************************************************************/
+enum class overflow_policy {
+    block,                                                  // wait for room, a worker runs the task itself
+    reject,                                                 // return false, the task is not queued
+    caller_runs,                                            // run the task on the adding thread
+    drop_oldest                                             // drop the least urgent queued task to make room
+};
+
+/*************************************************************************
+* > Class Name: task_dropped
+* > Father class: std::runtime_error
+* > Describe: given to the wait_group of a task destroyed before it ran,
+            e.g. dropped by overflow_policy::drop_oldest
+ ************************************************************************/
+class task_dropped : public std::runtime_error {
+public:
+    task_dropped() : std::runtime_error("Cgo::thread_pool: task dropped before it ran") {}
+};
+
+/*************************************************************************
+* > Enum Name: queue_backend
+* > Describe: container behind the global queue of thread_pool
+ ************************************************************************/
+enum class queue_backend {
+    locked_queue,                                           // std::queue guarded by a mutex
+    lock_free_ring                                          // bounded mpmc_queue, spills into the locked queue when full
+};
+
+/*************************************************************************
+* > Struct Name: cpu_info
+* > Describe: position of one logical cpu in the machine
+ ************************************************************************/
+struct cpu_info {
+    int cpu;                                                // logical cpu id
+    int package;                                            // socket
+    int core;                                               // core id inside the socket
+    int node;                                               // numa node
+};
+
+/*************************************************************************
+* > Class Name: cpu_topology
+* > Father class: none
+* > Describe: Read the cpus the process may run on and their socket, core
+            and numa node from sysfs. Missing sysfs entries (containers)
+            put every cpu on socket 0 and node 0.
+ ************************************************************************/
+class cpu_topology {
+public:
+
+    /*************************************************************************
+    * > Function Name: parse_list
+    * > From class: cpu_topology
+    * > Describe: parse a kernel cpu list such as "0-3,8-11"
+     ************************************************************************/
+    static std::vector<int> parse_list(const std::string &list) {
+        std::vector<int> cpus;
+        size_t pos = 0;
+        while (pos < list.size()) {
+            size_t end = list.find(',', pos);
+            if (end == std::string::npos) end = list.size();
+            std::string item = list.substr(pos, end - pos);
+            size_t dash = item.find('-');
+            if (!item.empty() && item[0] >= '0' && item[0] <= '9') {
+                int lo = std::atoi(item.c_str());
+                int hi = (dash == std::string::npos) ? lo : std::atoi(item.c_str() + dash + 1);
+                for (int c = lo; c <= hi; ++c) cpus.push_back(c);
+            }
+            pos = end + 1;
+        }
+        return cpus;
+    }
+
+    /*************************************************************************
+    * > Function Name: detect
+    * > From class: cpu_topology
+    * > Describe: every cpu of the affinity mask of the calling process
+     ************************************************************************/
+    static std::vector<cpu_info> detect() {
+        std::vector<cpu_info> result;
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        if (::sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return result;
+        std::vector<int> node_of(CPU_SETSIZE, 0);
+        if (DIR *dir = ::opendir("/sys/devices/system/node")) {
+            while (struct dirent *ent = ::readdir(dir)) {
+                if (::strncmp(ent->d_name, "node", 4) != 0) continue;
+                if (ent->d_name[4] < '0' || ent->d_name[4] > '9') continue;
+                int node = std::atoi(ent->d_name + 4);
+                std::string path = std::string("/sys/devices/system/node/") + ent->d_name + "/cpulist";
+                for (int c : parse_list(read_line(path))) {
+                    if (c >= 0 && c < CPU_SETSIZE) node_of[c] = node;
+                }
+            }
+            ::closedir(dir);
+        }
+        for (int c = 0; c < CPU_SETSIZE; ++c) {
+            if (!CPU_ISSET(c, &allowed)) continue;
+            std::string base = "/sys/devices/system/cpu/cpu" + std::to_string(c) + "/topology/";
+            std::string package = read_line(base + "physical_package_id");
+            std::string core = read_line(base + "core_id");
+            cpu_info info;
+            info.cpu = c;
+            info.package = package.empty() ? 0 : std::atoi(package.c_str());
+            info.core = core.empty() ? c : std::atoi(core.c_str());
+            info.node = node_of[c];
+            result.push_back(info);
+        }
+        return result;
+    }
+
+    /*************************************************************************
+    * > Function Name: bind_this_thread
+    * > From class: cpu_topology
+    * > Describe: restrict the calling thread to cpus
+    * > Return: 0 on success, otherwise an error number
+     ************************************************************************/
+    static int bind_this_thread(const std::vector<int> &cpus) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int c : cpus) {
+            if (c >= 0 && c < CPU_SETSIZE) CPU_SET(c, &set);
+        }
+        return ::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set);
+    }
+
+private:
+    static std::string read_line(const std::string &path) {
+        std::ifstream in(path);
+        std::string line;
+        std::getline(in, line);
+        return line;
+    }
+};
+
+/*************************************************************************
+* > Enum Name: worker_placement
+* > Describe: where thread_pool runs its workers
+ ************************************************************************/
+enum class worker_placement {
+    none,                                                   // leave it to the os scheduler
+    compact,                                                // pin worker i to one cpu, filling a socket first
+    scatter,                                                // pin worker i to one cpu, round robin over sockets
+    numa_node,                                              // every worker may run on any cpu of one numa node
+    cpuset                                                  // every worker may run on any cpu of a given set
+};
+
+/*************************************************************************
+* > Struct Name: latency_histogram
+* > Describe: log2 histogram of durations in nanoseconds. Bucket 0 counts
+*             zero, bucket i counts values in [2^(i-1), 2^i), the last
+*             bucket also takes everything above.
+ ************************************************************************/
+struct latency_histogram {
+    static constexpr int _buckets = 40;
+
+    uint64_t bucket[_buckets] = {};
+    uint64_t count = 0;                                     // recorded values
+    uint64_t sum_ns = 0;                                    // sum of recorded values
+    uint64_t max_ns = 0;                                    // largest recorded value
+
+    static int bucket_of(uint64_t ns) {
+        int b = (ns == 0) ? 0 : 64 - __builtin_clzll(ns);
+        return b < _buckets ? b : _buckets - 1;
+    }
+
+    /*************************************************************************
+    * > Function Name: mean_ns
+    * > From struct: latency_histogram
+     ************************************************************************/
+    double mean_ns() const {
+        return count == 0 ? 0.0 : (double)sum_ns / (double)count;
+    }
+
+    /*************************************************************************
+    * > Function Name: percentile
+    * > From struct: latency_histogram
+    * > Describe: upper bound of the bucket holding the p-th percentile,
+    *             p in [0, 100], never above max_ns
+     ************************************************************************/
+    uint64_t percentile(double p) const {
+        if (count == 0) return 0;
+        uint64_t rank = (uint64_t)(p / 100.0 * (double)count + 0.999999);
+        if (rank == 0) rank = 1;
+        uint64_t seen = 0;
+        for (int i = 0; i < _buckets; ++i) {
+            seen += bucket[i];
+            if (seen < rank) continue;
+            uint64_t upper = (i == 0) ? 0 : (uint64_t(1) << i) - 1;
+            return std::min(upper, max_ns);
+        }
+        return max_ns;
+    }
+
+    /*************************************************************************
+    * > Function Name: merge
+    * > From struct: latency_histogram
+     ************************************************************************/
+    void merge(const latency_histogram &other) {
+        for (int i = 0; i < _buckets; ++i) bucket[i] += other.bucket[i];
+        count += other.count;
+        sum_ns += other.sum_ns;
+        max_ns = std::max(max_ns, other.max_ns);
+        return ;
+    }
+};
+
+/*************************************************************************
+* > Struct Name: worker_stats
+* > Describe: counters of one worker slot at snapshot time
+ ************************************************************************/
+struct worker_stats {
+    int index = 0;                                          // slot of the worker
+    bool active = false;                                    // a thread runs the slot
+    int node = 0;                                           // numa node of the slot
+    uint64_t tasks = 0;                                     // tasks run
+    uint64_t steals = 0;                                    // successful steals
+    uint64_t parks = 0;                                     // times the worker slept
+    uint64_t busy_ns = 0;                                   // time spent running tasks
+    uint64_t idle_ns = 0;                                   // time spent parked
+
+    /*************************************************************************
+    * > Function Name: utilization
+    * > From struct: worker_stats
+    * > Describe: share of busy time in busy plus parked time
+     ************************************************************************/
+    double utilization() const {
+        uint64_t total = busy_ns + idle_ns;
+        return total == 0 ? 0.0 : (double)busy_ns / (double)total;
+    }
+};
+
+/*************************************************************************
+* > Struct Name: pool_memory
+* > Describe: memory held by queued tasks of a thread_pool
+ ************************************************************************/
+struct pool_memory {
+    size_t task_bytes = 0;                                  // queued task objects
+    size_t ring_bytes = 0;                                  // slots of the lock free ring
+    size_t slab_bytes = 0;                                  // chunks of the task allocator
+    size_t large_bytes = 0;                                 // callables too large for the slab
+
+    size_t total() const {
+        return task_bytes + ring_bytes + slab_bytes + large_bytes;
+    }
+};
+
+/*************************************************************************
+* > Struct Name: pool_stats
+* > Describe: aggregated view returned by thread_pool::snapshot()
+ ************************************************************************/
+struct pool_stats {
+    long queued = 0;                                        // tasks waiting in any queue
+    int live_threads = 0;                                   // running workers
+    int idle_threads = 0;                                   // parked workers
+    uint64_t tasks = 0;                                     // tasks run by all workers
+    uint64_t rejected = 0;                                  // tasks refused by overflow_policy::reject
+    uint64_t dropped = 0;                                   // tasks dropped by overflow_policy::drop_oldest
+    pool_memory memory;                                     // see thread_pool::memory_usage()
+    std::vector<worker_stats> workers;                      // one entry per slot
+    latency_histogram queue_wait;                           // enqueue to start of run
+    latency_histogram exec_time;                            // start to end of run
+};
+
+/*************************************************************************
+* > Struct Name: pool_options
+* > Describe: construction time settings of thread_pool
+ ************************************************************************/
+struct pool_options {
+    pool_mode mode = pool_mode::shared_queue;               // scheduling strategy
+    queue_backend backend = queue_backend::locked_queue;    // global queue container
+    size_t ring_capacity = 4096;                            // slots of the lock free ring
+    unsigned starvation_limit = 16;                         // urgent picks in a row before lower levels get a turn
+    int max_threads = 0;                                    // grow up to this many workers, 0 keeps the pool fixed
+    std::chrono::milliseconds keep_alive{ 30000 };          // idle time before an extra worker exits
+    std::chrono::microseconds grow_delay{ 500 };            // backlog time before one more worker starts
+    worker_placement placement = worker_placement::none;    // cpu placement of workers
+    int numa_node = 0;                                      // node used by worker_placement::numa_node
+    std::vector<int> cpus;                                  // cpus used by worker_placement::cpuset
+    bool metrics = false;                                   // collect per worker counters for snapshot()
+    int spin = 256;                                         // busy polls of an idle worker before it yields, 0 on a single cpu
+    int yields = 4;                                         // sched_yield polls before the worker parks
+    std::chrono::microseconds timer_tick{ 1000 };           // resolution of schedule_after/at/every
+    size_t capacity = 0;                                    // queued tasks before overflow applies, 0 is unbounded
+    overflow_policy overflow = overflow_policy::block;      // behaviour of a full pool
+    size_t trace_events = 0;                                // events kept per worker for write_trace(), 0 disables tracing
+
+    pool_options() = default;
+    pool_options(pool_mode mode) : mode(mode) {}
+};
+
+/*************************************************************************
+* > Class Name: thread_pool
+* > Father class: none
+* > Describe: Standardize the thread pool, which can be used to execute
+ ************************************************************************/
+class thread_pool {
+
+    using task_t = Cgo::task;
+    using mutex_t = std::mutex;
+    using cond_t = std::condition_variable;
+    using task_queue_t = std::deque<Cgo::task>;
+    using task_ring_t = Cgo::mpmc_queue<Cgo::task>;
+    using local_queue_t = std::deque<Cgo::task>;
+    using thread_ptrs_t = std::vector<std::thread *>;
+
+    /*************************************************************************
+    * > Struct Name: counters_t
+    * > Describe: metrics of one worker. Only the owning worker writes, so
+    *             updates are a relaxed load and store, never a locked
+    *             read-modify-write; snapshot() reads them from any thread.
+     ************************************************************************/
+    struct counters_t {
+        using counter_t = std::atomic<uint64_t>;
+
+        counter_t tasks{ 0 }, steals{ 0 }, parks{ 0 }, busy_ns{ 0 }, idle_ns{ 0 };
+        counter_t wait[latency_histogram::_buckets] = {}, wait_sum{ 0 }, wait_max{ 0 };
+        counter_t exec[latency_histogram::_buckets] = {}, exec_sum{ 0 }, exec_max{ 0 };
+
+        static void bump(counter_t &c, uint64_t v = 1) {
+            c.store(c.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+            return ;
+        }
+
+        static void record(counter_t *hist, counter_t &sum, counter_t &max, uint64_t ns) {
+            bump(hist[latency_histogram::bucket_of(ns)]);
+            bump(sum, ns);
+            if (ns > max.load(std::memory_order_relaxed)) max.store(ns, std::memory_order_relaxed);
+            return ;
+        }
+
+        static void copy(const counter_t *hist, const counter_t &sum, const counter_t &max, latency_histogram &out) {
+            for (int i = 0; i < latency_histogram::_buckets; ++i) {
+                out.bucket[i] = hist[i].load(std::memory_order_relaxed);
+                out.count += out.bucket[i];
+            }
+            out.sum_ns = sum.load(std::memory_order_relaxed);
+            out.max_ns = max.load(std::memory_order_relaxed);
+            return ;
+        }
+    };
+
+    /*************************************************************************
+    * > Struct Name: worker_t
+    * > Describe: per worker state, the deque is only used in work stealing
+    *             mode. The owner pushes and pops at the back, thieves take
+    *             from the front.
+     ************************************************************************/
+    struct alignas(64) worker_t {
+        thread_pool *pool;                                  // owner of this worker
+        int index;                                          // index in _workers
+        unsigned victim;                                    // next worker to steal from
+        mutex_t m_mutex;                                    // mutex for local deque
+        local_queue_t _tasks;                               // local deque
+        task_allocator::cache_t cache;                      // blocks of large tasks freed here
+        std::atomic<bool> active;                           // a thread runs this slot
+        int node;                                           // numa node of the cpus below
+        std::vector<int> cpus;                              // affinity of the thread, empty for none
+        std::vector<int> steal_order;                       // victims, same numa node first
+        int spin_budget;                                    // busy polls before the next park, adapts to hits
+        counters_t counters;                                // metrics, written by this worker only
+    };
+    using workers_t = std::vector<std::unique_ptr<worker_t>>;
+
+    /*************************************************************************
+    * > Struct Name: periodic_t
+    * > Describe: body of a schedule_every() timer, shared by its runs
+     ************************************************************************/
+    struct periodic_t {
+        std::function<void()> fn;                           // body
+        uint64_t period;                                    // timer ticks between runs
+        std::atomic<bool> running;                          // a run is queued or running
+    };
+
+    /*************************************************************************
+    * > Struct Name: timer_job_t
+    * > Describe: payload of the timer wheel
+     ************************************************************************/
+    struct timer_job_t {
+        task_t once;                                        // body of a one shot timer
+        std::shared_ptr<periodic_t> every;                  // body of a periodic timer
+    };
+
+    /*************************************************************************
+    * > Struct Name: group_ticket_t
+    * > Describe: body of submit(wg, ...). Marks the group done when run,
+    *             or fails it with task_dropped when destroyed unrun.
+     ************************************************************************/
+    template <typename CALL_T>
+    struct group_ticket_t {
+        Cgo::wait_group *group;                             // nullptr once accounted for
+        CALL_T call;                                        // callable and its arguments
+
+        group_ticket_t(Cgo::wait_group *wg, CALL_T &&c) : group(wg), call(std::move(c)) {}
+        group_ticket_t(group_ticket_t &&other) noexcept(std::is_nothrow_move_constructible<CALL_T>::value) :
+            group(std::exchange(other.group, nullptr)), call(std::move(other.call))
+        {}
+        group_ticket_t(const group_ticket_t &) = delete;
+
+        ~group_ticket_t() {
+            if (group == nullptr) return ;
+            group->fail(std::make_exception_ptr(task_dropped()));
+            group->done();
+        }
+
+        void operator()() {
+            Cgo::wait_group *wg = std::exchange(group, nullptr);
+            try {
+                std::apply([](auto &...c) { std::invoke(c...); }, call);
+            } catch (...) {
+                wg->fail(std::current_exception());
+            }
+            wg->done();
+            return ;
+        }
+    };
+    using steady_t = std::chrono::steady_clock;
+
+    static constexpr size_t _batch_max = 32;               // max tasks moved by one grab or steal
+    static constexpr int _help_spins = 64;                  // empty polls in wait() before blocking
+
+private:
+
+    task_allocator _alloc;                                  // storage of large tasks, outlives the queues
+    mutex_t m_mutex;                                        // mutex for global queue
+    mutex_t m_park_mutex;                                   // mutex for parking idle workers
+    mutex_t m_grow_mutex;                                   // mutex for starting and joining threads
+    cond_t m_cond;                                          // condition variable for idle workers
+    cond_t m_idle_cond;                                     // condition variable for drain()
+    bool state;                                             // thread_pool state
+    bool _stopping;                                         // set by stop(), guarded by m_park_mutex
+    pool_mode _mode;                                        // scheduling strategy
+    bool _metrics;                                          // collect counters_t and enqueue stamps
+    bool _tracing;                                          // record scheduler events into _traces
+    queue_backend _backend;                                 // global queue container
+    int _thread_num;                                        // number of threads, the minimum when elastic
+    int _max_threads;                                       // upper bound of live threads
+    bool _elastic;                                          // _max_threads > _thread_num
+    std::chrono::milliseconds _keep_alive;                  // idle time before an extra worker exits
+    long _grow_delay;                                       // backlog time in steady_clock ticks before growing
+    thread_ptrs_t _threads;                                 // pointers of threads, one per slot
+    workers_t _workers;                                     // per worker state
+    task_queue_t _tasks;                                    // global task queue
+    std::unique_ptr<task_ring_t> _ring;                     // global ring, lock free backend only
+    std::atomic<long> _spilled;                             // tasks in _tasks while _ring is used
+    std::atomic<long> _held;                                // pinned tasks put back at the front of _tasks
+    priority_task_queue _prio;                              // tasks with a non default task_sched
+    std::atomic<long> _queued;                              // tasks waiting in any queue
+    std::atomic<int> _idle;                                 // workers parked on m_cond
+    std::atomic<int> _live;                                 // running workers
+    std::atomic<long> _backlog_since;                       // steady_clock ticks when the backlog was seen, 0 if none
+    int _spin_max;                                          // upper bound of worker_t::spin_budget
+    int _yields;                                            // yields before parking
+    int _drainers;                                          // threads in drain(), guarded by m_park_mutex
+    mutex_t m_timer_mutex;                                  // mutex for the timer wheel
+    cond_t m_timer_cond;                                    // condition variable of the timer thread
+    timer_wheel<timer_job_t> _wheel;                        // pending schedule_* timers
+    std::thread *_timer_thread;                             // started by the first schedule_* call
+    bool _timer_stop;                                       // asks the timer thread to leave
+    uint64_t _timer_wake;                                   // tick the timer thread sleeps until, 0 while awake
+    steady_t::time_point _timer_epoch;                      // time of tick 0
+    steady_t::duration _timer_tick;                         // length of one tick
+    long _capacity;                                         // soft bound of _queued, 0 if unbounded
+    overflow_policy _overflow;                              // behaviour once _capacity is reached
+    mutex_t m_space_mutex;                                  // mutex for producers waiting for room
+    cond_t m_space_cond;                                    // condition variable for those producers
+    std::atomic<int> _blocked;                              // producers waiting on m_space_cond
+    std::atomic<uint64_t> _rejected;                        // tasks refused by overflow_policy::reject
+    std::atomic<uint64_t> _dropped;                         // tasks dropped by overflow_policy::drop_oldest
+    std::vector<std::unique_ptr<trace_ring>> _traces;       // one ring per slot, the last for other threads
+
+    /*************************************************************************
+    * > Function Name: this_worker
+    * > From class: thread_pool
+    * > Describe: worker state of the calling thread, nullptr outside workers
+     ************************************************************************/
+    static worker_t *&this_worker() {
+        static thread_local worker_t *w = nullptr;
+        return w;
+    }
+
+    /*************************************************************************
+    * > Function Name: push_task
+    * > From class: thread_pool
+    * > Describe: push task to the local deque when called from one of our
+    *             workers in work stealing mode, otherwise to global queue
+     ************************************************************************/
+    void push_task(task_t &&t) {
+        if (_metrics || _tracing) t.set_stamp(now_ns());
+        worker_t *w = this_worker();
+        if (_mode == pool_mode::work_stealing && w != nullptr && w->pool == this) {
+            std::unique_lock<std::mutex> locker(w->m_mutex);
+            w->_tasks.push_back(std::move(t));
+        } else if (_ring == nullptr || !_ring->try_push(std::move(t))) {
+            std::unique_lock<std::mutex> locker(m_mutex);
+            _tasks.push_back(std::move(t));
+            if (_ring != nullptr) _spilled.fetch_add(1);
+        }
+        this->notify_task();
+        return ;
+    }
+
+    /*************************************************************************
+    * > Function Name: push_sched
+    * > From class: thread_pool
+    * > Describe: default scheduled tasks take the usual queues, the others
+    *             go to the priority queue shared by all workers
+     ************************************************************************/
+    void push_sched(const task_sched &sched, task_t &&t) {
+        if (sched.is_default()) {
+            this->push_task(std::move(t));
+            return ;
+        }
+        if (_metrics || _tracing) t.set_stamp(now_ns());
+        _prio.push(sched, std::move(t));
+        this->notify_task();
+        return ;
+    }
+
+    /*************************************************************************
+    * > Function Name: push_tasks
+    * > From class: thread_pool
+    * > Describe: push n tasks taking each queue lock once, then wake at most
+    *             n parked workers
+     ************************************************************************/
+    void push_tasks(task_t *tasks, size_t n) {
+        if (n == 0) return ;
+        if (_metrics || _tracing) {
+            uint64_t now = now_ns();
+            for (size_t i = 0; i < n; ++i) tasks[i].set_stamp(now);
+        }
+        worker_t *w = this_worker();
+        if (_mode == pool_mode::work_stealing && w != nullptr && w->pool == this) {
+            std::unique_lock<std::mutex> locker(w->m_mutex);
+            for (size_t i = 0; i < n; ++i) w->_tasks.push_back(std::move(tasks[i]));
+        } else {
+            size_t i = 0;
+            if (_ring != nullptr) {
+                while (i < n && _ring->try_push(std::move(tasks[i]))) ++i;
+            }
+            if (i < n) {
+                std::unique_lock<std::mutex> locker(m_mutex);
+                for (size_t k = i; k < n; ++k) _tasks.push_back(std::move(tasks[k]));
+                if (_ring != nullptr) _spilled.fetch_add(n - i);
+            }
+        }
+        this->notify_task(n);
+        return ;
+    }
+
+    /*************************************************************************
+    * > Function Name: offer
+    * > From class: thread_pool
+    * > Describe: queue a task added by the user, through the overflow
+    *             policy when the pool is bounded. sched is nullptr for
+    *             default scheduling. Return false if t was refused.
+     ************************************************************************/
+    bool offer(task_t &&t, const task_sched *sched = nullptr) {
+        bool ran = false;
+        if (_capacity > 0 && !this->admit(t, ran)) return ran;
+        if (sched == nullptr) {
+            this->push_task(std::move(t));
+        } else {
+            this->push_sched(*sched, std::move(t));
+        }
+        return true;
+    }
+
+    /*************************************************************************
+    * > Function Name: offer_batch
+    * > From class: thread_pool
+    * > Describe: queue n tasks, as many as fit in one push_tasks() call and
+    *             the rest one by one through offer(). Return the number
+    *             accepted.
+     ************************************************************************/
+    size_t offer_batch(task_t *tasks, size_t n) {
+        if (_capacity <= 0) {
+            this->push_tasks(tasks, n);
+            return n;
+        }
+        long room = _capacity - _queued.load();
+        size_t first = room > 0 ? std::min(n, (size_t)room) : 0;
+        this->push_tasks(tasks, first);
+        size_t accepted = first;
+        for (size_t i = first; i < n; ++i) {
+            if (this->offer(std::move(tasks[i]))) accepted += 1;
+        }
+        return accepted;
+    }
+
+    /*************************************************************************
+    * > Function Name: task_taken
+    * > From class: thread_pool
+    * > Describe: count a task out of the queues and let a producer blocked
+    *             on a full pool go on. _queued and _blocked are seq_cst,
+    *             the same handshake as _queued and _idle.
+     ************************************************************************/
+    void task_taken() {
+        _queued.fetch_sub(1);
+        if (_blocked.load() > 0) {
+            std::unique_lock<std::mutex> locker(m_space_mutex);
+            locker.unlock();
+            m_space_cond.notify_one();
+        }
+        return ;
+    }
+
+    /*************************************************************************
+    * > Function Name: full
+    * > From class: thread_pool
+    * > Describe: bounded pool holding at least _capacity queued tasks
+     ************************************************************************/
+    bool full() const {
+        return _capacity > 0 && _queued.load() >= _capacity;
+    }
+
+    /*************************************************************************
+    * > Function Name: admit
+    * > From class: thread_pool
+    * > Describe: apply the overflow policy to t when the pool is full.
+    *             Return true when t should be queued. Otherwise t was run
+    *             here (ran is set) or refused. A worker of this pool never
+    *             blocks on its own pool, it runs the task instead.
+    *             The bound is soft: producers passing the check together
+    *             may overshoot it by one task each.
+     ************************************************************************/
+    bool admit(task_t &t, bool &ran) {
+        ran = false;
+        if (!this->full()) return true;
+        worker_t *w = this_worker();
+        bool own = (w != nullptr && w->pool == this);
+        switch (_overflow) {
+        case overflow_policy::reject:
+            _rejected.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        case overflow_policy::caller_runs:
+            t.run();
+            ran = true;
+            return false;
+        case overflow_policy::drop_oldest:
+            if (this->drop_oldest()) return true;
+            [[fallthrough]];
+        case overflow_policy::block:
+            if (own) {
+                t.run();
+                ran = true;
+                return false;
+            }
+            this->wait_for_room();
+            return true;
+        }
+        return true;
+    }
+
+    /*************************************************************************
+    * > Function Name: wait_for_room
+    * > From class: thread_pool
+    * > Describe: block the producer until the pool is below its capacity.
+    *             Gives up when no worker is left to make room.
+     ************************************************************************/
+    void wait_for_room() {
+        std::unique_lock<std::mutex> locker(m_space_mutex);
+        _blocked.fetch_add(1);
+        while (this->full() && _live.load() > 0) {
+            m_space_cond.wait_for(locker, std::chrono::milliseconds(10));
+        }
+        _blocked.fetch_sub(1);
+        return ;
+    }
+
+    /*************************************************************************
+    * > Function Name: drop_oldest
+    * > From class: thread_pool
+    * > Describe: destroy the least urgent queued task: a low priority one,
+    *             else the oldest unpinned one of the global queue. Tasks
+    *             more urgent than normal are never dropped, pinned ones
+    *             keep their place. Return false when nothing could be
+    *             dropped, the producer then waits for room as with block.
+     ************************************************************************/
+    bool drop_oldest() {
+        task_t victim;
+        bool found = _prio.size() > 0 && _prio.drop(victim, priority_task_queue::_outer_class);
+        if (!found) found = this->drop_global(victim);
+        if (!found) return false;
+        this->task_taken();
+        _dropped.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    /*************************************************************************
+    * > Function Name: drop_global
+    * > From class: thread_pool
+    * > Describe: take the oldest unpinned task of the global queue. Pinned
+    *             tasks popped from the ring on the way go to the front of
+    *             _tasks, which pop_global() serves before the ring, so
+    *             they keep their turn.
+     ************************************************************************/
+    bool drop_global(task_t &out) {
+        std::vector<task_t> pinned;
+        bool found = false;
+        if (_ring != nullptr) {
+            task_t t;
+            while (_ring->try_pop(t)) {
+                if (!t.pinned()) {
+                    out = std::move(t);
+                    found = true;
+                    break;
+                }
+                pinned.push_back(std::move(t));
+            }
+        }
+        std::unique_lock<std::mutex> locker(m_mutex);
+        for (size_t i = pinned.size(); i-- > 0; ) _tasks.push_front(std::move(pinned[i]));
+        if (!pinned.empty()) {
+            _spilled.fetch_add((long)pinned.size());
+            _held.fetch_add((long)pinned.size());
+        }
+        if (found) return true;
+        auto it = std::find_if(_tasks.begin(), _tasks.end(), [](const task_t &t) { return !t.pinned(); });
+        if (it == _tasks.end()) return false;
+        out = std::move(*it);
+        _tasks.erase(it);
+        if (_ring != nullptr) _spilled.fetch_sub(1);
+        return true;
+    }
+
+    /*************************************************************************
+    * > Function Name: notify_task
+    * > From class: thread_pool
+    * > Describe: publish n queued tasks and wake up to n parked workers.
+    *             _queued and _idle are both seq_cst, so either the producer
+    *             sees the parked worker or the worker sees the new task.
+     ************************************************************************/
+    void notify_task(size_t n = 1) {
+        if (_tracing) this->trace(trace_kind::enqueue, n);
+        _queued.fetch_add(n);
+        int idle = _idle.load();
+        if (idle <= 0) {
+            if (_elastic) this->maybe_grow();
+            return ;
+        }
+        if (n == 1) {
+            this->wake_one();
+            return ;
+        }
+        std::unique_lock<std::mutex> locker(m_park_mutex);
+        locker.unlock();
+        if (n >= (size_t)idle) {
+            m_cond.notify_all();
+        } else {
+            for (size_t i = 0; i < n; ++i) m_cond.notify_one();
+        }
+        return ;
+    }
+
+    /*************************************************************************
+    * > Function Name: maybe_grow
+    * > From class: thread_pool
+    * > Describe: start one more worker when no worker is idle and at least
+    *             as many tasks as live workers have been waiting for
+    *             _grow_delay. Called by producers and by busy workers.
+     ************************************************************************/
+    void maybe_grow() {
+        int live = _live.load();
+        if (live >= _max_threads) return ;
+        if (_queued.load() < live) {
+            _backlog_since.store(0, std::memory_order_relaxed);
+            return ;
+        }
+        long now = std::chrono::steady_clock::now().time_since_epoch().count();
+        long since = _backlog_since.load(std::memory_order_relaxed);
+        if (since == 0) {
+            _backlog_since.compare_exchange_strong(since, now, std::memory_order_relaxed);
+            return ;
+        }
+        if (now - since < _grow_delay) return ;
+        std::unique_lock<std::mutex> locker(m_grow_mutex, std::try_to_lock);
+        if (!locker.owns_lock() || state == false) return ;
+        _backlog_since.store(0, std::memory_order_relaxed);
+        for (int i = 0; i < _max_threads; ++i) {
+            if (_workers[i]->active.load()) continue;
+            this->start_worker(i);
+            break;
+        }
+        return ;
+    }
+
+    /*************************************************************************
+    * > Function Name: start_worker
+    * > From class: thread_pool
+    * > Describe: run a new thread on slot i, called with m_grow_mutex held.
+    *             A thread that left the slot before is joined first.
+     ************************************************************************/
+    void start_worker(int i) {
+        if (_threads[i] != nullptr) {
+            _threads[i]->join();
+            delete _threads[i];
+        }
+        _workers[i]->active.store(true);
+        _live.fetch_add(1);
+        _threads[i] = new std::thread(&thread_pool::worker, this, _workers[i].get());
+        return ;
+    }
+
+    /*************************************************************************
+    * > Function Name: try_retire
+    * > From class: thread_pool
+    * > Describe: let an idle worker go while more than _thread_num live
+     ************************************************************************/
+    bool try_retire() {
+        int live = _live.load();
+        while (live > _thread_num) {
+            if (_live.compare_exchange_weak(live, live - 1)) return true;
+        }
+        return false;
+    }
+
+    /*************************************************************************
+    * > Function Name: now_ns
+    * > From class: thread_pool
+    * > Describe: steady_clock in nanoseconds
+     ************************************************************************/
+    static uint64_t now_ns() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    /*************************************************************************
+    * > Function Name: run_measured
+    * > From class: thread_pool
+    * > Describe: run t and record its queue wait and run time in self
+     ************************************************************************/
+    void run_measured(worker_t *self, task_t &t) {
+        counters_t &c = self->counters;
+        uint64_t start = now_ns();
+        if (t.stamp() != 0 && start > t.stamp()) {
+            counters_t::record(c.wait, c.wait_sum, c.wait_max, start - t.stamp());
+        }
+        t.run();
+        uint64_t exec = now_ns() - start;
+        counters_t::record(c.exec, c.exec_sum, c.exec_max, exec);
+        counters_t::bump(c.tasks);
+        counters_t::bump(c.busy_ns, exec);
+        return ;
+    }
+
+    /*************************************************************************
+    * > Function Name: run_task
+    * > From class: thread_pool
+    * > Describe: run t on the calling thread, self is nullptr outside of
+    *             this pool's workers
+     ************************************************************************/
+    void run_task(worker_t *self, task_t &t) {
+        if (_tracing) this->trace(trace_kind::run_begin);
+        if (self != nullptr && _metrics) {
+            this->run_measured(self, t);
+        } else {
+            t.run();
+        }
+        if (_tracing) this->trace(trace_kind::run_end);
+        return ;
+    }
+
+    /*************************************************************************
+    * > Function Name: trace
+    * > From class: thread_pool
+    * > Describe: record an event in the ring of the calling thread. Workers
+    *             own a ring each, other threads share the last one.
+     ************************************************************************/
+    void trace(trace_kind kind, uint64_t arg = 0) {
+        worker_t *w = this_worker();
+        if (w != nullptr && w->pool == this) {
+            _traces[w->index]->record(now_ns(), (uint32_t)w->index, kind, arg);
+        } else {
+            _traces.back()->record(now_ns(), trace_other_tid + trace_thread_id(), kind, arg);
+        }
+        return ;
+    }
+
+    /*************************************************************************
+    * > Function Name: trace_dequeue
+    * > From class: thread_pool
+    * > Describe: record taking t out of a queue with the time it waited
+     ************************************************************************/
+    void trace_dequeue(const task_t &t) {
+        uint64_t now = now_ns();
+        this->trace(trace_kind::dequeue, (t.stamp() != 0 && now > t.stamp()) ? now - t.stamp() : 0);
+        return ;
+    }
+
+    /*************************************************************************
+    * > Function Name: place_workers
+    * > From class: thread_pool
+    * > Describe: give every slot its cpus and numa node, then order the
+    *             victims of every slot so stealing stays on the node first
+     ************************************************************************/
+    void place_workers(const pool_options &options) {
+        std::vector<cpu_info> cpus;
+        if (options.placement != worker_placement::none) cpus = cpu_topology::detect();
+        if (options.placement == worker_placement::numa_node || options.placement == worker_placement::cpuset) {
+            std::vector<int> set;
+            int node = options.numa_node;
+            for (const cpu_info &c : cpus) {
+                bool in = (options.placement == worker_placement::numa_node)
+                    ? (c.node == options.numa_node)
+                    : (std::find(options.cpus.begin(), options.cpus.end(), c.cpu) != options.cpus.end());
+                if (!in) continue;
+                set.push_back(c.cpu);
+                node = c.node;
+            }
+            for (auto &w : _workers) {
+                w->cpus = set;
+                w->node = node;
+            }
+        } else if (!cpus.empty()) {
+            if (options.placement == worker_placement::compact) {
+                std::sort(cpus.begin(), cpus.end(), [](const cpu_info &a, const cpu_info &b) {
+                    return std::make_tuple(a.package, a.core, a.cpu) < std::make_tuple(b.package, b.core, b.cpu);
+                });
+            } else {
+                // rank of the cpu inside its socket, then socket
+                std::vector<std::tuple<int, int, int>> key;
+                std::vector<int> seen;
+                for (const cpu_info &c : cpus) {
+                    int rank = (int)std::count(seen.begin(), seen.end(), c.package);
+                    seen.push_back(c.package);
+                    key.emplace_back(rank, c.package, c.cpu);
+                }
+                std::vector<size_t> idx(cpus.size());
+                for (size_t i = 0; i < idx.size(); ++i) idx[i] = i;
+                std::sort(idx.begin(), idx.end(), [&key](size_t a, size_t b) { return key[a] < key[b]; });
+                std::vector<cpu_info> sorted;
+                for (size_t i : idx) sorted.push_back(cpus[i]);
+                cpus.swap(sorted);
+            }
+            for (size_t i = 0; i < _workers.size(); ++i) {
+                const cpu_info &c = cpus[i % cpus.size()];
+                _workers[i]->cpus.assign(1, c.cpu);
+                _workers[i]->node = c.node;
+            }
+        }
+        int num = (int)_workers.size();
+        for (int i = 0; i < num; ++i) {
+            worker_t *w = _workers[i].get();
+            w->steal_order.clear();
+            for (int pass = 0; pass < 2; ++pass) {
+                for (int k = 1; k < num; ++k) {
+                    int j = (i + k) % num;
+                    bool near = (_workers[j]->node == w->node);
+                    if (near == (pass == 0)) w->steal_order.push_back(j);
+                }
+            }
+        }
+        return ;
+    }
+
+    /*************************************************************************
+    * > Function Name: wake_one
+    * > From class: thread_pool
+    * > Describe: wake one parked worker. Taking m_park_mutex first makes sure
+    *             a worker between its check and m_cond.wait is not missed.
+     ************************************************************************/
+    void wake_one() {
+        std::unique_lock<std::mutex> locker(m_park_mutex);
+        locker.unlock();
+        m_cond.notify_one();
+        return ;
+    }
+
+    /*************************************************************************
+    * > Function Name: pop_global
+    * > From class: thread_pool
+    * > Describe: take up to want tasks from the global queue. With the lock
+    *             free backend the ring is drained first and m_mutex is only
+    *             taken when tasks spilled over into _tasks, or pinned tasks
+    *             older than the ring wait at its front.
+     ************************************************************************/
+    size_t pop_global(task_t *out, size_t want) {
+        size_t n = 0;
+        if (_ring != nullptr) {
+            if (_held.load() > 0) n = this->pop_locked(out, want, true);
+            while (n < want && _ring->try_pop(out[n])) ++n;
+            if (n == want || _spilled.load() <= 0) return n;
+        }
+        return n + this->pop_locked(out + n, want - n, false);
+    }
+
+    /*************************************************************************
+    * > Function Name: pop_locked
+    * > From class: thread_pool
+    * > Describe: take up to want tasks from the front of _tasks, only the
+    *             held ones when held_only is set
+     ************************************************************************/
+    size_t pop_locked(task_t *out, size_t want, bool held_only) {
+        std::unique_lock<std::mutex> locker(m_mutex);
+        long held = _held.load();
+        if (held_only) want = std::min(want, (size_t)std::max(held, 0L));
+        size_t n = 0;
+        while (n < want && !_tasks.empty()) {
+            out[n++] = std::move(_tasks.front());
+            _tasks.pop_front();
+        }
+        if (_ring != nullptr) {
+            _spilled.fetch_sub((long)n);
+            if (held > 0) _held.fetch_sub(std::min(held, (long)n));
+        }
+        return n;
+    }
+
+    /*************************************************************************
+    * > Function Name: take_batch
+    * > From class: thread_pool
+    * > Describe: move part of the global queue into the local deque of self
+     ************************************************************************/
+    bool take_batch(worker_t *self, task_t &out) {
+        task_t batch[_batch_max];
+        size_t want = _queued.load() / (_live.load() + 1) + 1;
+        if (want > _batch_max) want = _batch_max;
+        size_t n = this->pop_global(batch, want);
+        if (n == 0) return false;
+        if (n > 1) {
+            std::unique_lock<std::mutex> locker(self->m_mutex);
+            for (size_t i = n - 1; i > 0; --i) self->_tasks.push_back(std::move(batch[i]));
+        }
+        out = std::move(batch[0]);
+        return true;
+    }
+
+    /*************************************************************************
+    * > Function Name: steal
+    * > From class: thread_pool
+    * > Describe: steal the older half of another worker's deque
+     ************************************************************************/
+    bool steal(worker_t *self, task_t &out) {
+        size_t num = self->steal_order.size();
+        task_t batch[_batch_max];
+        for (size_t k = 0; k <= num; ++k) {
+            // the last successful victim first, then nearest first
+            worker_t *victim = (k == 0) ? _workers[self->victim].get() : _workers[self->steal_order[k - 1]].get();
+            if (victim == self || (k > 0 && victim->index == (int)self->victim)) continue;
+            size_t n = 0;
+            {
+                std::unique_lock<std::mutex> locker(victim->m_mutex);
+                size_t want = (victim->_tasks.size() + 1) / 2;
+                if (want > _batch_max) want = _batch_max;
+                while (n < want) {
+                    batch[n++] = std::move(victim->_tasks.front());
+                    victim->_tasks.pop_front();
+                }
+            }
+            if (n == 0) continue;
+            self->victim = victim->index;
+            if (_metrics) counters_t::bump(self->counters.steals);
+            if (n > 1) {
+                std::unique_lock<std::mutex> locker(self->m_mutex);
+                for (size_t i = n - 1; i > 0; --i) self->_tasks.push_back(std::move(batch[i]));
+            }
+            out = std::move(batch[0]);
+            return true;
+        }
+        return false;
+    }
 
-public:
+    /*************************************************************************
+    * > Function Name: find_default
+    * > From class: thread_pool
+    * > Describe: non blocking lookup of a default scheduled task for self
+     ************************************************************************/
+    bool find_default(worker_t *self, task_t &out) {
+        if (_mode != pool_mode::work_stealing) {
+            return this->pop_global(&out, 1) == 1;
+        }
+        {
+            std::unique_lock<std::mutex> locker(self->m_mutex);
+            if (!self->_tasks.empty()) {
+                out = std::move(self->_tasks.back());
+                self->_tasks.pop_back();
+                return true;
+            }
+        }
+        if (this->take_batch(self, out)) return true;
+        return this->steal(self, out);
+    }
 
     /*************************************************************************
-    * > class task 
-    * > name : constructor
-    ************************************************************************/
-    template <typename FUNC_T, typename ...ARGS>
-    task(FUNC_T func, ARGS... args) {
-        this->_func = std::bind(func, std::forward<ARGS> (args)...);
+    * > Function Name: find_task
+    * > From class: thread_pool
+    * > Describe: non blocking lookup of the next task for self. The
+    *             priority queue is only locked while it holds tasks, so
+    *             pools using the default priority pay one relaxed load.
+     ************************************************************************/
+    bool find_task(worker_t *self, task_t &out) {
+        bool found = false;
+        if (_prio.size() > 0) {
+            found = _prio.pop(out, _queued.load() - _prio.size() > 0);
+            if (!found) found = this->find_default(self, out);
+            if (!found) found = _prio.pop(out, false);
+        } else {
+            found = this->find_default(self, out);
+        }
+        if (found) {
+            this->task_taken();
+            if (_tracing) this->trace_dequeue(out);
+        }
+        return found;
     }
 
     /*************************************************************************
-    * > class ~task 
-    * > name : destructor
+    * > Function Name: tick_of
+    * > From class: thread_pool
+    * > Describe: first timer tick not before tp
      ************************************************************************/
-    ~task() = default;
+    uint64_t tick_of(steady_t::time_point tp) const {
+        if (tp <= _timer_epoch) return 0;
+        return (uint64_t)((tp - _timer_epoch + _timer_tick - steady_t::duration(1)) / _timer_tick);
+    }
 
     /*************************************************************************
-    * > class task 
-    * > name : run 
-    * > Describe: : run the task
+    * > Function Name: add_timer
+    * > From class: thread_pool
+    * > Describe: put job on the wheel, start the timer thread on first use
+    *             and wake it when the new timer is due before it would
      ************************************************************************/
-    void run() {
-        this->_func();
+    timer_id add_timer(steady_t::time_point when, timer_job_t &&job) {
+        uint64_t tick = this->tick_of(when);
+        std::unique_lock<std::mutex> locker(m_timer_mutex);
+        if (_timer_thread == nullptr) {
+            _timer_stop = false;
+            _timer_thread = new std::thread(&thread_pool::timer_loop, this);
+        }
+        timer_id id = _wheel.add(tick, std::move(job));
+        if (_timer_wake != 0 && tick < _timer_wake) {
+            _timer_wake = 0;
+            m_timer_cond.notify_one();
+        }
+        return id;
+    }
+
+    /*************************************************************************
+    * > Function Name: timer_loop
+    * > From class: thread_pool
+    * > Describe: body of the timer thread. Due timers are collected while
+    *             the wheel is locked and queued with one push_tasks() call
+    *             after it is unlocked. A periodic timer whose last run has
+    *             not finished skips its turn, and one that fell behind
+    *             skips the missed turns instead of running them in a row.
+    *             Timers were admitted when scheduled, their tasks are pinned.
+     ************************************************************************/
+    void timer_loop() {
+        std::vector<task_t> due;
+        std::unique_lock<std::mutex> locker(m_timer_mutex);
+        while (!_timer_stop) {
+            uint64_t now = this->tick_of(steady_t::now());
+            _wheel.advance(now, [&](timer_id, uint64_t expire, timer_job_t &job) -> uint64_t {
+                if (!job.every) {
+                    due.push_back(std::move(job.once));
+                    due.back().set_pinned();
+                    return 0;
+                }
+                std::shared_ptr<periodic_t> p = job.every;
+                if (!p->running.exchange(true)) {
+                    due.emplace_back(std::allocator_arg, &_alloc, [p] {
+                        p->fn();
+                        p->running.store(false);
+                    });
+                    due.back().set_pinned();
+                }
+                uint64_t next = expire + p->period;
+                return next > now ? next : now + 1;
+            });
+            if (!due.empty()) {
+                locker.unlock();
+                this->push_tasks(due.data(), due.size());
+                due.clear();
+                locker.lock();
+                continue;
+            }
+            uint64_t next = _wheel.next_expiry();
+            _timer_wake = next;
+            if (next == UINT64_MAX) {
+                m_timer_cond.wait(locker);
+            } else {
+                m_timer_cond.wait_until(locker, _timer_epoch + _timer_tick * next);
+            }
+            _timer_wake = 0;
+        }
         return ;
     }
 
-private:
-    func_t _func;
-};
+    /*************************************************************************
+    * > Function Name: stop_timers
+    * > From class: thread_pool
+    * > Describe: end the timer thread and drop every pending timer
+     ************************************************************************/
+    void stop_timers() {
+        std::thread *t = nullptr;
+        {
+            std::unique_lock<std::mutex> locker(m_timer_mutex);
+            t = _timer_thread;
+            _timer_thread = nullptr;
+            _timer_stop = true;
+        }
+        m_timer_cond.notify_all();
+        if (t != nullptr) {
+            t->join();
+            delete t;
+        }
+        std::unique_lock<std::mutex> locker(m_timer_mutex);
+        _wheel.clear();
+        return ;
+    }
 
-/*************************************************************************
-* > Class Name: thread_pool
-* > Father class: none
-* > Describe: Standardize the thread pool, which can be used to execute
- ************************************************************************/
-class thread_pool {
+    /*************************************************************************
+    * > Function Name: spin_for_task
+    * > From class: thread_pool
+    * > Describe: poll for work a little before parking, first busy then
+    *             with sched_yield. A spinning worker does not count as
+    *             idle, so producers skip the wakeup. The busy phase is
+    *             halved each time it finds nothing and restored on a hit,
+    *             so it costs little when the pool is really idle.
+     ************************************************************************/
+    bool spin_for_task(worker_t *self, task_t &out) {
+        for (int i = 0; i < self->spin_budget; ++i) {
+            cpu_relax();
+            if (_queued.load(std::memory_order_relaxed) > 0 && this->find_task(self, out)) {
+                self->spin_budget = _spin_max;
+                return true;
+            }
+        }
+        for (int i = 0; i < _yields; ++i) {
+            std::this_thread::yield();
+            if (_queued.load(std::memory_order_relaxed) > 0 && this->find_task(self, out)) {
+                self->spin_budget = _spin_max;
+                return true;
+            }
+        }
+        self->spin_budget = std::max(_spin_max / 8, self->spin_budget / 2);
+        return false;
+    }
 
-    using task_t = Cgo::task;
-    using mutex_t = std::mutex;
-    using cond_t = std::condition_variable;
-    using running_t = std::unordered_map<std::thread::id, bool>;
-    using task_queue_t = std::queue<Cgo::task *>;
-    using thread_ptrs_t = std::vector<std::thread *>;
+    /*************************************************************************
+    * > Function Name: cpu_relax
+    * > From class: thread_pool
+    * > Describe: hint the cpu that we are in a spin loop
+     ************************************************************************/
+    static void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield" ::: "memory");
+#endif
+        return ;
+    }
 
-private:
-    
-    mutex_t m_mutex;                                        // mutex for queue
-    cond_t m_cond;                                          // condition variable for queue
-    bool state;                                             // thread_pool state
-    int _thread_num;                                        // number of threads
-    thread_ptrs_t _threads;                                 // pointers of threads
-    running_t _running;                                     // thread running state
-    task_queue_t _tasks;                                    // task queue
+    /*************************************************************************
+    * > Function Name: quiet
+    * > From class: thread_pool
+    * > Describe: nothing queued and every live worker parked
+     ************************************************************************/
+    bool quiet() const {
+        return _queued.load() <= 0 && _idle.load() >= _live.load();
+    }
 
     /*************************************************************************
-    * > Function Name: stop_running
+    * > Function Name: notify_quiet
     * > From class: thread_pool
-    * > Describe: poisom method
+    * > Describe: wake drain() callers once the pool went quiet, called
+    *             with m_park_mutex held
      ************************************************************************/
-    void _stop_running() {
-        auto id = std::this_thread::get_id();
-        this->_running[id] = false;
+    void notify_quiet() {
+        if (_drainers > 0 && this->quiet()) m_idle_cond.notify_all();
         return ;
     }
 
     /*************************************************************************
     * > Function Name: get_task
     * > From class: thread_pool
-    * > Describe: get task from task queue
+    * > Describe: get task for self, park while every queue is empty.
+    *             Return false once stop() is called and no task is left,
+    *             or when an elastic pool lets this idle worker go.
      ************************************************************************/
-    task_t *get_task() {
-        std::unique_lock<std::mutex> locker(m_mutex); while (_tasks.empty()) {
-            m_cond.wait(locker);
+    bool get_task(worker_t *self, task_t &out) {
+        for (;;) {
+            if (this->find_task(self, out) || this->spin_for_task(self, out)) {
+                if (_queued.load() > 0) {
+                    // more work than awake workers, pass the wakeup on
+                    if (_idle.load() > 0) {
+                        this->wake_one();
+                    } else if (_elastic) {
+                        this->maybe_grow();
+                    }
+                }
+                return true;
+            }
+            std::unique_lock<std::mutex> locker(m_park_mutex);
+            bool timeout = false;
+            uint64_t park_start = _metrics ? now_ns() : 0;
+            if (_tracing) this->trace(trace_kind::park);
+            _idle.fetch_add(1);
+            this->notify_quiet();
+            if (_elastic) _backlog_since.store(0, std::memory_order_relaxed);
+            while (_queued.load() <= 0 && !_stopping && !timeout) {
+                if (!_elastic) {
+                    m_cond.wait(locker);
+                } else {
+                    timeout = (m_cond.wait_for(locker, _keep_alive) == std::cv_status::timeout);
+                }
+            }
+            _idle.fetch_sub(1);
+            if (_tracing) this->trace(trace_kind::wake);
+            if (_metrics) {
+                counters_t::bump(self->counters.parks);
+                counters_t::bump(self->counters.idle_ns, now_ns() - park_start);
+            }
+            if (_queued.load() <= 0 && _stopping) return false;
+            if (timeout && _queued.load() <= 0 && this->try_retire()) {
+                this->notify_quiet();
+                return false;
+            }
         }
-        Cgo::task *t = _tasks.front();
-        _tasks.pop();
-        return t;
     }
 
 public:
@@ -119,7 +2240,47 @@ public:
     * > name : constructor 
     * > Describe: : init information about thread_pool
      ************************************************************************/
-    thread_pool(int thread_num = 1) : _thread_num(thread_num), _threads(thread_num), state(false)   {
+    thread_pool(int thread_num = 1, pool_mode mode = pool_mode::shared_queue) :
+        thread_pool(thread_num, pool_options(mode))
+    {}
+
+    /*************************************************************************
+    * > class thread_pool 
+    * > name : constructor 
+    * > Describe: : init thread_pool with the given options
+     ************************************************************************/
+    thread_pool(int thread_num, const pool_options &options) :
+        state(false), _stopping(false), _mode(options.mode), _metrics(options.metrics), _tracing(options.trace_events > 0), _backend(options.backend),
+        _thread_num(thread_num), _max_threads(std::max(thread_num, options.max_threads)),
+        _elastic(_max_threads > thread_num), _keep_alive(options.keep_alive),
+        _grow_delay(std::chrono::duration_cast<std::chrono::steady_clock::duration>(options.grow_delay).count()),
+        _threads(_max_threads, nullptr), _spilled(0), _held(0), _prio(options.starvation_limit),
+        _queued(0), _idle(0), _live(0), _backlog_since(0),
+        _spin_max(std::max(0, options.spin)), _yields(std::max(0, options.yields)), _drainers(0),
+        _timer_thread(nullptr), _timer_stop(false), _timer_wake(0), _timer_epoch(steady_t::now()),
+        _timer_tick(std::max<steady_t::duration>(steady_t::duration(1),
+            std::chrono::duration_cast<steady_t::duration>(options.timer_tick))),
+        _capacity((long)options.capacity), _overflow(options.overflow), _blocked(0), _rejected(0), _dropped(0)
+    {
+        // spinning on a single cpu only keeps the producer from running
+        if (std::thread::hardware_concurrency() <= 1) _spin_max = 0;
+        if (_backend == queue_backend::lock_free_ring) {
+            _ring.reset(new task_ring_t(options.ring_capacity));
+        }
+        if (_tracing) {
+            for (int i = 0; i <= _max_threads; ++i) _traces.emplace_back(new trace_ring(options.trace_events));
+        }
+        for (int i = 0; i < _max_threads; ++i) {
+            _workers.emplace_back(new worker_t());
+            _workers[i]->pool = this;
+            _workers[i]->index = i;
+            _workers[i]->victim = i;
+            _workers[i]->cache.owner = &_alloc;
+            _workers[i]->active.store(false);
+            _workers[i]->node = 0;
+            _workers[i]->spin_budget = _spin_max;
+        }
+        this->place_workers(options);
         this->start();
         return ;
     }
@@ -131,9 +2292,11 @@ public:
      ************************************************************************/
     ~thread_pool() {
         this->stop();
-        while (!_tasks.empty()) {
-            delete _tasks.front();
-            _tasks.pop();
+        _tasks.clear();
+        _ring.reset();
+        _prio.clear();
+        for (auto &w : _workers) {
+            w->_tasks.clear();
         }
         return ;
     }
@@ -145,9 +2308,14 @@ public:
     * > Describe: : make all thread start to work
      ************************************************************************/
     void start() {
+        std::unique_lock<std::mutex> locker(m_grow_mutex);
         if (state == true) return ;
+        {
+            std::unique_lock<std::mutex> park_locker(m_park_mutex);
+            _stopping = false;
+        }
         for (int i = 0; i < _thread_num; ++i) {
-            _threads[i] = new std::thread(&thread_pool::worker, this);
+            this->start_worker(i);
         }
         state = true;
         return ;
@@ -158,14 +2326,19 @@ public:
     * > From class: thread_pool
     * > Describe: make all thread start to work
      ************************************************************************/
-    void worker() {
-        auto id = std::this_thread::get_id();
-        _running[id] = true;
-        while (_running[id]) {
-            Cgo::task *t = get_task();
-            t->run();
-            delete t;
+    void worker(worker_t *self) {
+        if (!self->cpus.empty()) cpu_topology::bind_this_thread(self->cpus);
+        this_worker() = self;
+        task_allocator::this_cache() = &self->cache;
+        task_t t;
+        while (get_task(self, t)) {
+            this->run_task(self, t);
+            t.clear();
         }
+        _alloc.release(&self->cache);
+        task_allocator::this_cache() = nullptr;
+        this_worker() = nullptr;
+        self->active.store(false);
         return ;
     }
 
@@ -173,14 +2346,305 @@ public:
     /*************************************************************************
     * > Function Name: add_task
     * > From class: thread_pool
-    * > Describe: add task to thread_pool
+    * > Describe: add task to thread_pool. Return false when a full pool
+    *             refused it (overflow_policy::reject), true otherwise.
+     ************************************************************************/
+    template <typename FUNC_T, typename ...ARGS,
+              typename = typename std::enable_if<!std::is_convertible<FUNC_T, task_sched>::value>::type>
+    bool add_task(FUNC_T func, ARGS... args) {
+        return this->offer(task_t(std::allocator_arg, &_alloc, std::move(func), std::forward<ARGS> (args)...));
+    }
+
+    /*************************************************************************
+    * > Function Name: add_task
+    * > From class: thread_pool
+    * > Describe: add task with a priority level and/or deadline
      ************************************************************************/
     template <typename FUNC_T, typename ...ARGS>
-    void add_task(FUNC_T func, ARGS... args) {
-        std::unique_lock<std::mutex> locker(m_mutex);
-        _tasks.push(new task(func, std::forward<ARGS> (args)...));
-        locker.unlock();
-        m_cond.notify_one();
+    bool add_task(const task_sched &sched, FUNC_T func, ARGS... args) {
+        return this->offer(task_t(std::allocator_arg, &_alloc, std::move(func), std::forward<ARGS> (args)...), &sched);
+    }
+
+    /*************************************************************************
+    * > Function Name: spawn
+    * > From class: thread_pool
+    * > Describe: add a task continuing work the pool already accepted, such
+    *             as the next step of a running task. It skips the overflow
+    *             policy and is never dropped, so it cannot block a worker
+    *             on its own pool or lose a part of a started job.
+     ************************************************************************/
+    template <typename FUNC_T, typename ...ARGS>
+    void spawn(FUNC_T func, ARGS... args) {
+        task_t t(std::allocator_arg, &_alloc, std::move(func), std::forward<ARGS> (args)...);
+        t.set_pinned();
+        this->push_task(std::move(t));
+        return ;
+    }
+
+    /*************************************************************************
+    * > Function Name: add_tasks
+    * > From class: thread_pool
+    * > Describe: add every callable of [begin, end) to thread_pool under one
+    *             lock and wake only as many workers as there are tasks.
+    *             Return the number of tasks accepted.
+     ************************************************************************/
+    template <typename ITER_T>
+    size_t add_tasks(ITER_T begin, ITER_T end) {
+        std::vector<task_t> batch;
+        if constexpr (std::is_base_of<std::forward_iterator_tag,
+                          typename std::iterator_traits<ITER_T>::iterator_category>::value) {
+            batch.reserve(std::distance(begin, end));
+        }
+        for (; begin != end; ++begin) {
+            batch.emplace_back(std::allocator_arg, &_alloc, *begin);
+        }
+        return this->offer_batch(batch.data(), batch.size());
+    }
+
+    /*************************************************************************
+    * > Function Name: add_task_batch
+    * > From class: thread_pool
+    * > Describe: add n tasks calling func(i, args...) for i in [0, n) under
+    *             one lock, the usual way to split one request into parts.
+    *             Return the number of tasks accepted.
+     ************************************************************************/
+    template <typename FUNC_T, typename ...ARGS>
+    size_t add_task_batch(size_t n, FUNC_T func, ARGS... args) {
+        std::vector<task_t> batch;
+        batch.reserve(n);
+        for (size_t i = 0; i < n; ++i) {
+            batch.emplace_back(std::allocator_arg, &_alloc, func, i, args...);
+        }
+        return this->offer_batch(batch.data(), batch.size());
+    }
+
+    /*************************************************************************
+    * > Function Name: submit
+    * > From class: thread_pool
+    * > Describe: add task to thread_pool and return a future of its result,
+    *             an exception thrown by the task is rethrown by future::get.
+    *             A task refused or dropped by a full pool leaves the future
+    *             with std::future_error(broken_promise).
+     ************************************************************************/
+    template <typename FUNC_T, typename ...ARGS>
+    auto submit(FUNC_T func, ARGS... args) -> std::future<typename std::invoke_result<FUNC_T &, ARGS &...>::type> {
+        using ret_t = typename std::invoke_result<FUNC_T &, ARGS &...>::type;
+        std::packaged_task<ret_t()> job(std::bind(std::move(func), std::forward<ARGS> (args)...));
+        std::future<ret_t> result = job.get_future();
+        this->offer(task_t(std::allocator_arg, &_alloc, std::move(job)));
+        return result;
+    }
+
+    /*************************************************************************
+    * > Function Name: submit
+    * > From class: thread_pool
+    * > Describe: submit() with a priority level and/or deadline
+     ************************************************************************/
+    template <typename FUNC_T, typename ...ARGS>
+    auto submit(const task_sched &sched, FUNC_T func, ARGS... args) -> std::future<typename std::invoke_result<FUNC_T &, ARGS &...>::type> {
+        using ret_t = typename std::invoke_result<FUNC_T &, ARGS &...>::type;
+        std::packaged_task<ret_t()> job(std::bind(std::move(func), std::forward<ARGS> (args)...));
+        std::future<ret_t> result = job.get_future();
+        this->offer(task_t(std::allocator_arg, &_alloc, std::move(job)), &sched);
+        return result;
+    }
+
+    /*************************************************************************
+    * > Function Name: submit
+    * > From class: thread_pool
+    * > Describe: add task to thread_pool and count it in wg, no shared state
+    *             is allocated. wg.wait() rethrows the first exception; a
+    *             task refused or dropped by a full pool fails wg with
+    *             task_dropped. Return false when the task was refused.
+     ************************************************************************/
+    template <typename FUNC_T, typename ...ARGS>
+    bool submit(Cgo::wait_group &wg, FUNC_T func, ARGS... args) {
+        using call_t = decltype(std::make_tuple(std::move(func), std::forward<ARGS> (args)...));
+        static_assert(std::is_nothrow_move_constructible<group_ticket_t<call_t>>::value
+                      == std::is_nothrow_move_constructible<call_t>::value,
+                      "a group ticket must be stored inline whenever its size allows");
+        wg.add(1);
+        return this->offer(task_t(std::allocator_arg, &_alloc,
+            group_ticket_t<call_t>(&wg, std::make_tuple(std::move(func), std::forward<ARGS> (args)...))));
+    }
+
+#ifdef __Cgo_COROUTINE__
+    /*************************************************************************
+    * > Struct Name: schedule_t
+    * > Describe: awaitable returned by schedule(). The awaiting coroutine is
+    *             queued as an inline task holding only its handle, so no
+    *             allocation happens per hop. The task is pinned: a
+    *             suspended coroutine must not be dropped or refused.
+     ************************************************************************/
+    struct schedule_t {
+        thread_pool *pool;
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> h) {
+            task_t t(std::allocator_arg, &pool->_alloc, [h] { h.resume(); });
+            t.set_pinned();
+            pool->push_task(std::move(t));
+            return ;
+        }
+        void await_resume() const noexcept {}
+    };
+
+    /*************************************************************************
+    * > Function Name: schedule
+    * > From class: thread_pool
+    * > Describe: co_await pool.schedule() continues the coroutine on one of
+    *             the workers. Called from a worker of this pool the
+    *             coroutine goes to the local deque, where an idle worker
+    *             can steal it.
+     ************************************************************************/
+    schedule_t schedule() {
+        return schedule_t{ this };
+    }
+#endif
+
+    /*************************************************************************
+    * > Function Name: run_pending
+    * > From class: thread_pool
+    * > Describe: run one queued task on the calling thread. Return false
+    *             when nothing is queued. Lets a thread that waits for pool
+    *             work help instead of blocking; a worker of this pool looks
+    *             in its own deque first and may steal, other threads only
+    *             take from the shared queues.
+     ************************************************************************/
+    bool run_pending() {
+        task_t t;
+        worker_t *w = this_worker();
+        bool own = (w != nullptr && w->pool == this);
+        if (own) {
+            if (!this->find_task(w, t)) return false;
+        } else {
+            bool found = (_prio.size() > 0 && _prio.pop(t, false));
+            if (!found) found = (this->pop_global(&t, 1) == 1);
+            if (!found) return false;
+            this->task_taken();
+            if (_tracing) this->trace_dequeue(t);
+        }
+        this->run_task(own ? w : nullptr, t);
+        return true;
+    }
+
+    /*************************************************************************
+    * > Function Name: wait
+    * > From class: thread_pool
+    * > Describe: wait for wg while running queued tasks on the calling
+    *             thread. Once nothing is queued the pending tasks already
+    *             run elsewhere, so after a short spin the caller blocks.
+    *             Rethrows the first exception of the group.
+     ************************************************************************/
+    void wait(Cgo::wait_group &wg) {
+        int spins = 0;
+        while (wg.pending() > 0 && spins < _help_spins) {
+            if (this->run_pending()) {
+                spins = 0;
+            } else {
+                spins += 1;
+                std::this_thread::yield();
+            }
+        }
+        wg.wait();
+        return ;
+    }
+
+    /*************************************************************************
+    * > Function Name: schedule_at
+    * > From class: thread_pool
+    * > Describe: add func(args...) to the pool once when is reached.
+    *             Times are rounded up to pool_options::timer_tick. Return
+    *             an id for cancel_timer().
+     ************************************************************************/
+    template <typename CLOCK_T, typename DURATION_T, typename FUNC_T, typename ...ARGS>
+    timer_id schedule_at(std::chrono::time_point<CLOCK_T, DURATION_T> when, FUNC_T func, ARGS... args) {
+        steady_t::time_point at = steady_t::now() +
+            std::chrono::duration_cast<steady_t::duration>(when - CLOCK_T::now());
+        timer_job_t job;
+        job.once = task_t(std::allocator_arg, &_alloc, std::move(func), std::forward<ARGS> (args)...);
+        return this->add_timer(at, std::move(job));
+    }
+
+    /*************************************************************************
+    * > Function Name: schedule_after
+    * > From class: thread_pool
+    * > Describe: add func(args...) to the pool once after delay
+     ************************************************************************/
+    template <typename REP_T, typename PERIOD_T, typename FUNC_T, typename ...ARGS>
+    timer_id schedule_after(std::chrono::duration<REP_T, PERIOD_T> delay, FUNC_T func, ARGS... args) {
+        timer_job_t job;
+        job.once = task_t(std::allocator_arg, &_alloc, std::move(func), std::forward<ARGS> (args)...);
+        return this->add_timer(steady_t::now() + std::chrono::duration_cast<steady_t::duration>(delay), std::move(job));
+    }
+
+    /*************************************************************************
+    * > Function Name: schedule_every
+    * > From class: thread_pool
+    * > Describe: add func(args...) to the pool every period, first after
+    *             one period, until cancel_timer(). A turn is skipped while
+    *             the previous run has not finished.
+     ************************************************************************/
+    template <typename REP_T, typename PERIOD_T, typename FUNC_T, typename ...ARGS>
+    timer_id schedule_every(std::chrono::duration<REP_T, PERIOD_T> period, FUNC_T func, ARGS... args) {
+        steady_t::duration step = std::chrono::duration_cast<steady_t::duration>(period);
+        auto p = std::make_shared<periodic_t>();
+        p->fn = [call = std::make_tuple(std::move(func), std::forward<ARGS> (args)...)]() mutable {
+            std::apply([](auto &...c) { std::invoke(c...); }, call);
+        };
+        p->period = std::max<uint64_t>(1, (uint64_t)((step + _timer_tick - steady_t::duration(1)) / _timer_tick));
+        p->running.store(false);
+        timer_job_t job;
+        job.every = std::move(p);
+        return this->add_timer(steady_t::now() + step, std::move(job));
+    }
+
+    /*************************************************************************
+    * > Function Name: cancel_timer
+    * > From class: thread_pool
+    * > Describe: cancel a timer in O(1). False if it already fired (one
+    *             shot) or is unknown; a run already queued is not undone.
+     ************************************************************************/
+    bool cancel_timer(timer_id id) {
+        std::unique_lock<std::mutex> locker(m_timer_mutex);
+        return _wheel.cancel(id);
+    }
+
+    /*************************************************************************
+    * > Function Name: drain
+    * > From class: thread_pool
+    * > Describe: wait until every queued task ran and all workers are
+    *             parked, at most timeout. Return whether the pool went
+    *             quiet. Tasks added meanwhile are waited for as well.
+    *             The pool keeps running; must not be called from one of
+    *             its own tasks.
+     ************************************************************************/
+    template <typename REP_T, typename PERIOD_T>
+    bool drain(std::chrono::duration<REP_T, PERIOD_T> timeout) {
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        std::unique_lock<std::mutex> locker(m_park_mutex);
+        if (_live.load() == 0) return _queued.load() <= 0;
+        _drainers += 1;
+        while (!this->quiet()) {
+            if (m_idle_cond.wait_until(locker, deadline) == std::cv_status::timeout) break;
+        }
+        _drainers -= 1;
+        return this->quiet();
+    }
+
+    /*************************************************************************
+    * > Function Name: wait_idle
+    * > From class: thread_pool
+    * > Describe: drain() without a time limit
+     ************************************************************************/
+    void wait_idle() {
+        std::unique_lock<std::mutex> locker(m_park_mutex);
+        if (_live.load() == 0) return ;
+        _drainers += 1;
+        while (!this->quiet()) {
+            m_idle_cond.wait(locker);
+        }
+        _drainers -= 1;
         return ;
     }
 
@@ -193,23 +2657,169 @@ public:
         return this->_thread_num;
     }
 
+    /*************************************************************************
+    * > Function Name: get_max_thread_num
+    * > From class: thread_pool
+    * > Describe: get upper bound of thread number
+     ************************************************************************/
+    int get_max_thread_num() {
+        return this->_max_threads;
+    }
+
+    /*************************************************************************
+    * > Function Name: get_live_thread_num
+    * > From class: thread_pool
+    * > Describe: get number of running threads, changes with load when
+    *             the pool is elastic
+     ************************************************************************/
+    int get_live_thread_num() {
+        return _live.load();
+    }
+
+    /*************************************************************************
+    * > Function Name: snapshot
+    * > From class: thread_pool
+    * > Describe: aggregate the counters of every worker. Queue depth and
+    *             thread numbers are always filled, the rest needs
+    *             pool_options::metrics.
+     ************************************************************************/
+    pool_stats snapshot() {
+        pool_stats stats;
+        stats.queued = std::max(0L, _queued.load());
+        stats.live_threads = _live.load();
+        stats.idle_threads = _idle.load();
+        for (auto &w : _workers) {
+            const counters_t &c = w->counters;
+            worker_stats ws;
+            ws.index = w->index;
+            ws.active = w->active.load();
+            ws.node = w->node;
+            ws.tasks = c.tasks.load(std::memory_order_relaxed);
+            ws.steals = c.steals.load(std::memory_order_relaxed);
+            ws.parks = c.parks.load(std::memory_order_relaxed);
+            ws.busy_ns = c.busy_ns.load(std::memory_order_relaxed);
+            ws.idle_ns = c.idle_ns.load(std::memory_order_relaxed);
+            stats.tasks += ws.tasks;
+            stats.workers.push_back(ws);
+            latency_histogram wait, exec;
+            counters_t::copy(c.wait, c.wait_sum, c.wait_max, wait);
+            counters_t::copy(c.exec, c.exec_sum, c.exec_max, exec);
+            stats.queue_wait.merge(wait);
+            stats.exec_time.merge(exec);
+        }
+        stats.rejected = _rejected.load(std::memory_order_relaxed);
+        stats.dropped = _dropped.load(std::memory_order_relaxed);
+        stats.memory = this->memory_usage();
+        return stats;
+    }
+
+    /*************************************************************************
+    * > Function Name: memory_usage
+    * > From class: thread_pool
+    * > Describe: memory held for queued tasks. The slab counts whole chunks,
+    *             including blocks freed back to it, since they are not
+    *             returned to the system before the pool is destroyed.
+     ************************************************************************/
+    pool_memory memory_usage() {
+        pool_memory mem;
+        mem.task_bytes = (size_t)std::max(0L, _queued.load()) * sizeof(task_t);
+        mem.ring_bytes = (_ring != nullptr) ? _ring->bytes() : 0;
+        mem.slab_bytes = _alloc.slab_bytes();
+        mem.large_bytes = _alloc.large_bytes();
+        return mem;
+    }
+
+    /*************************************************************************
+    * > Function Name: tracing
+    * > From class: thread_pool
+    * > Describe: pool_options::trace_events was set
+     ************************************************************************/
+    bool tracing() const {
+        return _tracing;
+    }
+
+    /*************************************************************************
+    * > Function Name: trace_events
+    * > From class: thread_pool
+    * > Describe: copy of the events still held by the rings, ordered by
+    *             time. Safe while the pool runs; events written during the
+    *             copy may be missing.
+     ************************************************************************/
+    std::vector<trace_event> trace_events() {
+        std::vector<trace_event> events;
+        for (auto &ring : _traces) ring->collect(events);
+        std::stable_sort(events.begin(), events.end(), [](const trace_event &a, const trace_event &b) {
+            return a.ts < b.ts;
+        });
+        return events;
+    }
+
+    /*************************************************************************
+    * > Function Name: write_trace
+    * > From class: thread_pool
+    * > Describe: write trace_events() as Chrome trace JSON, open it in
+    *             ui.perfetto.dev or chrome://tracing
+     ************************************************************************/
+    void write_trace(std::ostream &out) {
+        write_chrome_trace(out, this->trace_events());
+        return ;
+    }
+
+    /*************************************************************************
+    * > Function Name: write_trace
+    * > From class: thread_pool
+    * > Describe: write the trace to file path, false if it cannot be written
+     ************************************************************************/
+    bool write_trace(const std::string &path) {
+        std::ofstream out(path);
+        if (!out) return false;
+        this->write_trace(out);
+        return (bool)out;
+    }
+
+    /*************************************************************************
+    * > Function Name: get_mode
+    * > From class: thread_pool
+    * > Describe: get scheduling strategy
+     ************************************************************************/
+    pool_mode get_mode() {
+        return this->_mode;
+    }
+
+    /*************************************************************************
+    * > Function Name: get_backend
+    * > From class: thread_pool
+    * > Describe: get global queue container
+     ************************************************************************/
+    queue_backend get_backend() {
+        return this->_backend;
+    }
+
     /*************************************************************************
     * > Function Name: stop
     * > From class: thread_pool
-    * > Describe: stop all task and release all resource
+    * > Describe: run every queued task, then stop all threads.
+    *             Workers leave once all queues are empty, so tasks added
+    *             before stop() still run, as with the former poison tasks.
+    *             Timers not due yet are dropped.
      ************************************************************************/
     void stop() {
+        this->stop_timers();
+        std::unique_lock<std::mutex> locker(m_grow_mutex);
         if (state == false) return ;
-        for (int i = 0; i < _thread_num; ++i) {
-            this->add_task(&thread_pool::_stop_running, this);
+        {
+            std::unique_lock<std::mutex> park_locker(m_park_mutex);
+            _stopping = true;
         }
-        for (int i = 0; i < _thread_num; ++i) {
-            _threads[i]->join();
+        m_cond.notify_all();
+        for (int i = 0; i < _max_threads; ++i) {
+            if (_threads[i] != nullptr) _threads[i]->join();
         }
-        for (int i = 0; i < _thread_num; ++i) {
+        for (int i = 0; i < _max_threads; ++i) {
             delete _threads[i];
             _threads[i] = nullptr;
         }
+        _live.store(0);
         state = false;
         return ;
     }
@@ -0,0 +1,313 @@
+/*************************************************************************
+	> File Name: Cgo-TimerWheel.h
+	> Author:Royi
+	> Mail:royi990001@gmail.com
+	> Describe: hierarchical timer wheel
+************************************************************************/
+#ifndef _TIMER_WHEEL_H__
+#define _TIMER_WHEEL_H__
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+
+#ifndef __NAMESPACE_Cgo_BEGIN__
+#define __NAMESPACE_Cgo_BEGIN__ namespace Cgo {
+#define __NAMESPACE_Cgo_END__  }
+#endif
+
+__NAMESPACE_Cgo_BEGIN__
+
+using timer_id = uint64_t;                                  // generation << 32 | slot, 0 is never used
+
+/*************************************************************************
+* > Class Name: timer_wheel
+* > Father class: none
+* > Describe: Hashed hierarchical timing wheel over integer ticks. Four
+            levels of 64 slots cover 2^24 ticks; later timers park in
+            the top level and are put back until they come in range.
+            Timers live in one vector and are linked by 32 bit indices,
+            so a timer costs the payload plus 24 bytes. Adding and
+            cancelling are O(1); a timer_id stays valid until its timer
+            fired or was cancelled and is never reused for another one.
+            Not thread safe, the owner locks around it.
+ ************************************************************************/
+template <typename PAYLOAD_T>
+class timer_wheel {
+
+    static constexpr int _bits = 6;
+    static constexpr int _levels = 4;
+    static constexpr uint32_t _slots = 1u << _bits;
+    static constexpr uint32_t _mask = _slots - 1;
+    static constexpr uint32_t _nil = 0xffffffffu;
+    static constexpr uint64_t _range = uint64_t(1) << (_bits * _levels);
+
+    struct node_t {
+        PAYLOAD_T payload;                                  // user data
+        uint64_t expire;                                    // tick the timer is due at
+        uint32_t prev;                                      // list links, _nil ends a list
+        uint32_t next;
+        uint32_t gen;                                       // bumped whenever the node is freed
+        uint16_t slot;                                      // level * _slots + slot, or _free_slot
+    };
+
+    static constexpr uint16_t _free_slot = 0xffff;
+
+public:
+
+    /*************************************************************************
+    * > class timer_wheel
+    * > name : constructor
+    * > Describe: : now is the current tick
+     ************************************************************************/
+    explicit timer_wheel(uint64_t now = 0) : _now(now), _count(0), _free(_nil) {
+        for (uint32_t i = 0; i < _levels * _slots; ++i) _heads[i] = _nil;
+    }
+
+    /*************************************************************************
+    * > class timer_wheel
+    * > name : add
+    * > Describe: : add a timer due at tick expire, a tick not after now
+    *               fires on the next advance()
+     ************************************************************************/
+    timer_id add(uint64_t expire, PAYLOAD_T payload) {
+        uint32_t i = _free;
+        if (i != _nil) {
+            _free = _nodes[i].next;
+        } else {
+            i = (uint32_t)_nodes.size();
+            _nodes.emplace_back();
+            _nodes[i].gen = 1;
+        }
+        node_t &n = _nodes[i];
+        n.payload = std::move(payload);
+        n.expire = expire;
+        this->link(i, _now + 1);
+        _count += 1;
+        return ((timer_id)n.gen << 32) | i;
+    }
+
+    /*************************************************************************
+    * > class timer_wheel
+    * > name : cancel
+    * > Describe: : remove a pending timer, false if it already fired, was
+    *               cancelled before or never existed
+     ************************************************************************/
+    bool cancel(timer_id id) {
+        uint32_t i = (uint32_t)id;
+        if (i >= _nodes.size()) return false;
+        node_t &n = _nodes[i];
+        if (n.slot == _free_slot || n.gen != (uint32_t)(id >> 32)) return false;
+        this->unlink(i);
+        this->release(i);
+        return true;
+    }
+
+    /*************************************************************************
+    * > class timer_wheel
+    * > name : advance
+    * > Describe: : move time forward to tick now. Every due timer is taken
+    *               out and passed to on_expire(id, expire, payload), which
+    *               returns the next tick to re-arm the same id at, or 0 to
+    *               let the timer go. on_expire must not add or cancel
+    *               timers of this wheel.
+     ************************************************************************/
+    template <typename FUNC_T>
+    void advance(uint64_t now, FUNC_T &&on_expire) {
+        while (_now < now) {
+            if (_count == 0) {
+                _now = now;
+                break;
+            }
+            _now += 1;
+            for (int l = 1; l < _levels; ++l) {
+                // a lower level wrapped around, move the next slot of level l down
+                if ((_now & ((uint64_t(1) << (_bits * l)) - 1)) != 0) break;
+                this->cascade(l, (uint32_t)(_now >> (_bits * l)) & _mask);
+            }
+            uint32_t s = (uint32_t)_now & _mask;
+            uint32_t i = _heads[s];
+            _heads[s] = _nil;
+            while (i != _nil) {
+                uint32_t next = _nodes[i].next;
+                if (_nodes[i].expire > _now) {
+                    this->link(i, _now + 1);
+                } else {
+                    this->fire(i, on_expire);
+                }
+                i = next;
+            }
+        }
+        return ;
+    }
+
+    /*************************************************************************
+    * > class timer_wheel
+    * > name : next_expiry
+    * > Describe: : earliest tick advance() has work at, a due timer or a
+    *               slot to move down. UINT64_MAX when no timer is pending.
+     ************************************************************************/
+    uint64_t next_expiry() const {
+        if (_count == 0) return UINT64_MAX;
+        uint64_t best = UINT64_MAX;
+        for (uint32_t k = 1; k <= _slots; ++k) {
+            if (_heads[(uint32_t)(_now + k) & _mask] != _nil) {
+                best = _now + k;
+                break;
+            }
+        }
+        for (int l = 1; l < _levels; ++l) {
+            uint64_t digit = _now >> (_bits * l);
+            for (uint32_t k = 1; k <= _slots; ++k) {
+                if (_heads[l * _slots + ((uint32_t)(digit + k) & _mask)] == _nil) continue;
+                uint64_t tick = (digit + k) << (_bits * l);
+                if (tick < best) best = tick;
+                break;
+            }
+        }
+        return best;
+    }
+
+    /*************************************************************************
+    * > class timer_wheel
+    * > name : now
+    * > Describe: : last tick advance() reached
+     ************************************************************************/
+    uint64_t now() const {
+        return _now;
+    }
+
+    /*************************************************************************
+    * > class timer_wheel
+    * > name : size
+    * > Describe: : pending timers
+     ************************************************************************/
+    size_t size() const {
+        return _count;
+    }
+
+    /*************************************************************************
+    * > class timer_wheel
+    * > name : clear
+    * > Describe: : drop every pending timer
+     ************************************************************************/
+    void clear() {
+        for (uint32_t i = 0; i < _nodes.size(); ++i) {
+            if (_nodes[i].slot == _free_slot) continue;
+            this->release(i);
+        }
+        for (uint32_t i = 0; i < _levels * _slots; ++i) _heads[i] = _nil;
+        return ;
+    }
+
+private:
+
+    /*************************************************************************
+    * > class timer_wheel
+    * > name : link
+    * > Describe: : put node i into the slot its expire maps to, not before
+    *               tick first
+     ************************************************************************/
+    void link(uint32_t i, uint64_t first) {
+        node_t &n = _nodes[i];
+        uint64_t expire = n.expire > first ? n.expire : first;
+        uint64_t delta = expire - _now;
+        if (delta >= _range) {
+            // too far ahead, park it in the top level and look again later
+            expire = _now + _range - 1;
+            delta = _range - 1;
+        }
+        int l = 0;
+        while (l < _levels - 1 && delta >= (uint64_t(1) << (_bits * (l + 1)))) ++l;
+        uint32_t s = l * _slots + ((uint32_t)(expire >> (_bits * l)) & _mask);
+        n.slot = (uint16_t)s;
+        n.prev = _nil;
+        n.next = _heads[s];
+        if (n.next != _nil) _nodes[n.next].prev = i;
+        _heads[s] = i;
+        return ;
+    }
+
+    /*************************************************************************
+    * > class timer_wheel
+    * > name : unlink
+    * > Describe: : take node i out of its slot
+     ************************************************************************/
+    void unlink(uint32_t i) {
+        node_t &n = _nodes[i];
+        if (n.prev != _nil) {
+            _nodes[n.prev].next = n.next;
+        } else {
+            _heads[n.slot] = n.next;
+        }
+        if (n.next != _nil) _nodes[n.next].prev = n.prev;
+        return ;
+    }
+
+    /*************************************************************************
+    * > class timer_wheel
+    * > name : release
+    * > Describe: : destroy the payload of node i and put it on the free list
+     ************************************************************************/
+    void release(uint32_t i) {
+        node_t &n = _nodes[i];
+        n.payload = PAYLOAD_T();
+        n.slot = _free_slot;
+        n.gen = (n.gen + 1 == 0) ? 1 : n.gen + 1;
+        n.next = _free;
+        _free = i;
+        _count -= 1;
+        return ;
+    }
+
+    /*************************************************************************
+    * > class timer_wheel
+    * > name : cascade
+    * > Describe: : move the timers of slot s of level l to lower levels
+     ************************************************************************/
+    void cascade(int l, uint32_t s) {
+        uint32_t i = _heads[l * _slots + s];
+        _heads[l * _slots + s] = _nil;
+        while (i != _nil) {
+            uint32_t next = _nodes[i].next;
+            // the level 0 slot of the current tick is still to be run
+            this->link(i, _now);
+            i = next;
+        }
+        return ;
+    }
+
+    /*************************************************************************
+    * > class timer_wheel
+    * > name : fire
+    * > Describe: : hand node i to on_expire, then re-arm or free it
+     ************************************************************************/
+    template <typename FUNC_T>
+    void fire(uint32_t i, FUNC_T &on_expire) {
+        timer_id id = ((timer_id)_nodes[i].gen << 32) | i;
+        uint64_t next = on_expire(id, _nodes[i].expire, _nodes[i].payload);
+        if (next != 0) {
+            _nodes[i].expire = next;
+            this->link(i, _now + 1);
+        } else {
+            this->release(i);
+        }
+        return ;
+    }
+
+    uint64_t _now;                                          // last tick advanced to
+    size_t _count;                                          // pending timers
+    uint32_t _free;                                         // free list of _nodes
+    uint32_t _heads[_levels * _slots];                      // first node of every slot
+    std::vector<node_t> _nodes;                             // all timers, linked by index
+};
+
+__NAMESPACE_Cgo_END__
+
+// DATE: 2024-08-03
+// FILENAME: timer_wheel.h
+// AUTHOR: royi
+// END:
+
+#endif
@@ -0,0 +1,246 @@
+/*************************************************************************
+	> File Name: Cgo-Trace.h
+	> Author:Royi
+	> Mail:royi990001@gmail.com
+	> Describe: scheduler event rings and Chrome trace JSON output
+************************************************************************/
+#ifndef _TRACE_H__
+#define _TRACE_H__
+
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <ostream>
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+#include <cstddef>
+
+#ifndef __NAMESPACE_Cgo_BEGIN__
+#define __NAMESPACE_Cgo_BEGIN__ namespace Cgo {
+#define __NAMESPACE_Cgo_END__  }
+#endif
+
+__NAMESPACE_Cgo_BEGIN__
+
+/*************************************************************************
+* > Enum Name: trace_kind
+* > Describe: scheduler events recorded by a tracing thread_pool
+ ************************************************************************/
+enum class trace_kind : uint8_t {
+    enqueue,                                                // arg: tasks added
+    dequeue,                                                // arg: ns the task waited, 0 if unknown
+    run_begin,
+    run_end,
+    park,                                                   // worker goes to sleep
+    wake                                                    // worker woke up
+};
+
+static constexpr uint32_t trace_other_tid = 1u << 16;       // tids from here on are not workers
+
+/*************************************************************************
+* > Struct Name: trace_event
+* > Describe: one recorded event. tid is the worker index for workers and
+*             trace_other_tid + n for the n-th other thread that traced.
+ ************************************************************************/
+struct trace_event {
+    uint64_t ts = 0;                                        // steady_clock ns
+    uint32_t tid = 0;                                       // track of the event
+    trace_kind kind = trace_kind::enqueue;
+    uint64_t arg = 0;                                       // see trace_kind
+};
+
+/*************************************************************************
+* > Function Name: trace_thread_id
+* > Describe: small number of the calling thread, the n in
+*             trace_other_tid + n
+ ************************************************************************/
+inline uint32_t trace_thread_id() {
+    static std::atomic<uint32_t> next{ 0 };
+    static thread_local uint32_t id = next.fetch_add(1, std::memory_order_relaxed);
+    return id;
+}
+
+/*************************************************************************
+* > Class Name: trace_ring
+* > Father class: none
+* > Describe: fixed size event ring that overwrites its oldest events.
+            A writer claims a slot with one fetch_add and publishes it
+            through a per slot sequence number, so recording never
+            locks and any number of threads may share a ring. Readers
+            copy a slot and keep it only when its sequence number did
+            not change meanwhile.
+ ************************************************************************/
+class trace_ring {
+
+    struct slot_t {
+        std::atomic<uint64_t> seq{ 0 };                     // index + 1 once written, 0 while writing
+        std::atomic<uint64_t> ts{ 0 };
+        std::atomic<uint64_t> info{ 0 };                    // tid << 8 | kind
+        std::atomic<uint64_t> arg{ 0 };
+    };
+
+public:
+
+    /*************************************************************************
+    * > class trace_ring
+    * > name : constructor
+    * > Describe: : capacity is rounded up to a power of two
+     ************************************************************************/
+    explicit trace_ring(size_t capacity) : _head(0) {
+        size_t size = 2;
+        while (size < capacity) size <<= 1;
+        _slots.reset(new slot_t[size]);
+        _mask = size - 1;
+    }
+
+    /*************************************************************************
+    * > class trace_ring
+    * > name : record
+    * > Describe: : append an event, wait free
+     ************************************************************************/
+    void record(uint64_t ts, uint32_t tid, trace_kind kind, uint64_t arg) {
+        uint64_t i = _head.fetch_add(1, std::memory_order_relaxed);
+        slot_t &s = _slots[i & _mask];
+        s.seq.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        s.ts.store(ts, std::memory_order_relaxed);
+        s.info.store(((uint64_t)tid << 8) | (uint64_t)kind, std::memory_order_relaxed);
+        s.arg.store(arg, std::memory_order_relaxed);
+        s.seq.store(i + 1, std::memory_order_release);
+        return ;
+    }
+
+    /*************************************************************************
+    * > class trace_ring
+    * > name : collect
+    * > Describe: : append the events still held to out, oldest first.
+    *               Events overwritten or half written meanwhile are skipped.
+     ************************************************************************/
+    void collect(std::vector<trace_event> &out) const {
+        uint64_t head = _head.load(std::memory_order_acquire);
+        uint64_t size = _mask + 1;
+        uint64_t first = head > size ? head - size : 0;
+        for (uint64_t i = first; i < head; ++i) {
+            const slot_t &s = _slots[i & _mask];
+            uint64_t seq = s.seq.load(std::memory_order_acquire);
+            if (seq != i + 1) continue;
+            trace_event e;
+            e.ts = s.ts.load(std::memory_order_relaxed);
+            uint64_t info = s.info.load(std::memory_order_relaxed);
+            e.arg = s.arg.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (s.seq.load(std::memory_order_relaxed) != seq) continue;
+            e.tid = (uint32_t)(info >> 8);
+            e.kind = (trace_kind)(info & 0xff);
+            out.push_back(e);
+        }
+        return ;
+    }
+
+    /*************************************************************************
+    * > class trace_ring
+    * > name : written
+    * > Describe: : events recorded so far, including overwritten ones
+     ************************************************************************/
+    uint64_t written() const {
+        return _head.load(std::memory_order_relaxed);
+    }
+
+    size_t capacity() const {
+        return _mask + 1;
+    }
+
+private:
+    alignas(64) std::atomic<uint64_t> _head;                // next index to write
+    std::unique_ptr<slot_t[]> _slots;                       // event storage
+    uint64_t _mask;                                         // capacity - 1
+};
+
+/*************************************************************************
+* > Function Name: write_chrome_trace
+* > Describe: write events as Chrome trace JSON, readable by
+*             chrome://tracing and ui.perfetto.dev. Runs and parks become
+*             complete events on the track of their thread; a begin whose
+*             end was not recorded (or the other way round) is left out.
+*             Enqueues and dequeues become instant events.
+ ************************************************************************/
+inline void write_chrome_trace(std::ostream &out, std::vector<trace_event> events) {
+    std::stable_sort(events.begin(), events.end(), [](const trace_event &a, const trace_event &b) {
+        return a.tid != b.tid ? a.tid < b.tid : a.ts < b.ts;
+    });
+    uint64_t epoch = UINT64_MAX;
+    for (auto &e : events) epoch = std::min(epoch, e.ts);
+    char buf[256];
+    bool first = true;
+    auto emit = [&](int n) {
+        out << (first ? "\n" : ",\n");
+        out.write(buf, n);
+        first = false;
+    };
+    auto us = [&](uint64_t ns) { return (double)(ns - epoch) / 1000.0; };
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    size_t i = 0;
+    while (i < events.size()) {
+        uint32_t tid = events[i].tid;
+        if (tid < trace_other_tid) {
+            emit(std::snprintf(buf, sizeof(buf),
+                "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"worker %u\"}}",
+                tid, tid));
+        } else {
+            emit(std::snprintf(buf, sizeof(buf),
+                "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"thread %u\"}}",
+                tid, tid - trace_other_tid));
+        }
+        // a task may run others inline (wait(), a full pool), so runs nest
+        std::vector<const trace_event *> runs;
+        const trace_event *park = nullptr;
+        auto complete = [&](const char *name, const trace_event &begin, const trace_event &end) {
+            emit(std::snprintf(buf, sizeof(buf),
+                "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                name, tid, us(begin.ts), (double)(end.ts - begin.ts) / 1000.0));
+        };
+        for (; i < events.size() && events[i].tid == tid; ++i) {
+            const trace_event &e = events[i];
+            switch (e.kind) {
+            case trace_kind::run_begin:
+                runs.push_back(&e);
+                break;
+            case trace_kind::run_end:
+                if (runs.empty()) break;
+                complete("run", *runs.back(), e);
+                runs.pop_back();
+                break;
+            case trace_kind::park:
+                park = &e;
+                break;
+            case trace_kind::wake:
+                if (park == nullptr) break;
+                complete("idle", *park, e);
+                park = nullptr;
+                break;
+            case trace_kind::enqueue:
+                emit(std::snprintf(buf, sizeof(buf),
+                    "{\"name\":\"enqueue\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"args\":{\"tasks\":%llu}}",
+                    tid, us(e.ts), (unsigned long long)e.arg));
+                break;
+            case trace_kind::dequeue:
+                emit(std::snprintf(buf, sizeof(buf),
+                    "{\"name\":\"dequeue\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"args\":{\"wait_us\":%.3f}}",
+                    tid, us(e.ts), (double)e.arg / 1000.0));
+                break;
+            }
+        }
+    }
+    out << "\n]}\n";
+    return ;
+}
+
+__NAMESPACE_Cgo_END__
+
+// DATE: 2024-08-03
+// FILENAME: trace.h
+// AUTHOR: royi
+// END:
+
+#endif
@@ -0,0 +1,745 @@
+/*************************************************************************
+	> File Name: Cgo-Uring.h
+	> Author:Royi
+	> Mail:royi990001@gmail.com
+	> Describe: io_uring backend of Cgo::io_service, raw syscalls only
+************************************************************************/
+#ifndef _URING_H__
+#define _URING_H__
+
+#include "Cgo-IoService.h"
+
+#include <csignal>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+__NAMESPACE_Cgo_BEGIN__
+
+/*************************************************************************
+* > Struct Name: uring_options
+* > Describe: sizes of a uring_service
+ ************************************************************************/
+struct uring_options {
+    unsigned entries = 256;                                 // submission queue slots, completions get four times as many
+    unsigned buffers = 512;                                 // provided recv buffers, rounded up to a power of two
+    unsigned buffer_size = 4096;                            // bytes per recv buffer
+};
+
+/*************************************************************************
+* > Class Name: uring_service
+* > Father class: io_service
+* > Describe: io_service on io_uring, for Linux 6.0 or newer. Operations
+            are queued as submission entries and handed to the kernel
+            together with the wait for completions, one io_uring_enter
+            per round however many operations were started. accept()
+            is one multishot accept and recv() one multishot recv that
+            picks buffers from a provided buffer ring, so a busy socket
+            costs no syscall per message at all. Only one send per fd is
+            in flight, the next starts when it completed, which keeps
+            partial sends in order. Throws std::system_error from the
+            constructor when io_uring cannot be set up, e.g. in a
+            sandbox that forbids it; make_io_service() falls back then.
+ ************************************************************************/
+class uring_service : public io_service {
+
+    enum class op_kind : uint8_t { accept, recv, send, connect };
+
+    struct op_t {
+        op_kind kind;                                       // operation
+        int fd;                                             // socket
+        bool cancelled;                                     // callback already ran in cancel(), drop results
+        accept_cb on_accept;                                // callback of the kind
+        recv_cb on_recv;
+        send_cb on_send;
+        connect_cb on_connect;
+        const char *buf;                                    // send data
+        size_t len;                                         // send length
+        size_t done;                                        // bytes sent so far
+        struct ::sockaddr_storage addr;                     // connect address
+        socklen_t addr_len;
+        op_t *next_free;                                    // free list link
+    };
+
+    struct fd_ops_t {
+        op_t *accept = nullptr;                             // multishot accept in flight
+        op_t *recv = nullptr;                               // multishot recv in flight
+        op_t *connect = nullptr;                            // connect in flight
+        std::deque<op_t *> sends;                           // front in flight, the rest waits
+    };
+
+    static constexpr uint64_t _cancel_key = 0;              // user_data of cancel requests
+    static constexpr uint64_t _wake_key = 1;                // user_data of the eventfd read
+    static constexpr uint16_t _group = 0;                   // provided buffer group id
+
+public:
+
+    /*************************************************************************
+    * > class uring_service
+    * > name : constructor
+    * > Describe: : set up the rings and the provided buffer ring, pool runs
+    *               offload() work and may be nullptr
+     ************************************************************************/
+    explicit uring_service(thread_pool *pool = nullptr, const uring_options &options = uring_options()) :
+        io_service(pool), _ring_fd(-1), _wake_fd(-1), _sq_ptr(nullptr), _cq_ptr(nullptr), _sqes(nullptr),
+        _sq_size(0), _cq_size(0), _sqes_size(0), _sq_local(0),
+        _br(nullptr), _br_size(0), _buffers(nullptr), _nbuf(2), _buf_size(options.buffer_size),
+        _free_ops(nullptr), _stop(false), _wake_pending(false), _wake_value(0)
+    {
+        while (_nbuf < options.buffers) _nbuf <<= 1;
+        try {
+            this->setup(options.entries);
+            this->setup_buffers();
+            _wake_fd = ::eventfd(0, EFD_CLOEXEC);
+            if (_wake_fd < 0) this->fail("eventfd");
+        } catch (...) {
+            this->teardown();
+            throw;
+        }
+        this->arm_wake();
+    }
+
+    ~uring_service() {
+        this->teardown();
+    }
+
+    void accept(int fd, accept_cb cb) override {
+        op_t *op = this->new_op(op_kind::accept, fd);
+        op->on_accept = std::move(cb);
+        _fds[fd].accept = op;
+        this->submit_op(op);
+        return ;
+    }
+
+    void recv(int fd, recv_cb cb) override {
+        op_t *op = this->new_op(op_kind::recv, fd);
+        op->on_recv = std::move(cb);
+        _fds[fd].recv = op;
+        this->submit_op(op);
+        return ;
+    }
+
+    void send(int fd, const void *buf, size_t len, send_cb cb) override {
+        op_t *op = this->new_op(op_kind::send, fd);
+        op->on_send = std::move(cb);
+        op->buf = static_cast<const char *>(buf);
+        op->len = len;
+        std::deque<op_t *> &sends = _fds[fd].sends;
+        sends.push_back(op);
+        if (sends.size() == 1) this->submit_op(op);
+        return ;
+    }
+
+    void connect(int fd, const struct ::sockaddr *addr, socklen_t len, connect_cb cb) override {
+        op_t *op = this->new_op(op_kind::connect, fd);
+        op->on_connect = std::move(cb);
+        op->addr_len = std::min<socklen_t>(len, sizeof(op->addr));
+        std::memcpy(&op->addr, addr, op->addr_len);
+        _fds[fd].connect = op;
+        this->submit_op(op);
+        return ;
+    }
+
+    /*************************************************************************
+    * > class uring_service
+    * > name : cancel
+    * > Describe: : every operation on fd ends with -ECANCELED before this
+    *               returns, as with epoll_service. The cancel request goes
+    *               to the kernel at once, while fd is still open, and the
+    *               kernel drops the send buffer with it. Later completions
+    *               of these operations are dropped; an accepted fd among
+    *               them is closed.
+     ************************************************************************/
+    void cancel(int fd) override {
+        auto it = _fds.find(fd);
+        if (it == _fds.end()) return ;
+        fd_ops_t ops = std::move(it->second);
+        _fds.erase(it);
+        struct io_uring_sqe *sqe = this->get_sqe();
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = fd;
+        sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+        sqe->user_data = _cancel_key;
+        this->enter(0);
+        // the ops stay allocated until their last completion, the ones
+        // never handed to the kernel go back now
+        accept_cb on_accept;
+        recv_cb on_recv;
+        connect_cb on_connect;
+        std::vector<send_cb> on_send;
+        if (ops.accept != nullptr) {
+            ops.accept->cancelled = true;
+            on_accept = std::move(ops.accept->on_accept);
+        }
+        if (ops.recv != nullptr) {
+            ops.recv->cancelled = true;
+            on_recv = std::move(ops.recv->on_recv);
+        }
+        if (ops.connect != nullptr) {
+            ops.connect->cancelled = true;
+            on_connect = std::move(ops.connect->on_connect);
+        }
+        for (size_t i = 0; i < ops.sends.size(); ++i) {
+            ops.sends[i]->cancelled = true;
+            on_send.push_back(std::move(ops.sends[i]->on_send));
+            if (i != 0) this->free_op(ops.sends[i]);
+        }
+        if (on_accept) on_accept(-ECANCELED);
+        if (on_recv) on_recv(nullptr, -ECANCELED);
+        if (on_connect) on_connect(-ECANCELED);
+        for (auto &cb : on_send) cb(-ECANCELED);
+        return ;
+    }
+
+    int run_once(int timeout_ms = -1) override {
+        if (this->enter(timeout_ms) < 0) return -1;
+        return this->reap();
+    }
+
+    void post(std::function<void()> fn) override {
+        bool wake = false;
+        {
+            std::unique_lock<std::mutex> locker(m_mutex);
+            _posted.push_back(std::move(fn));
+            if (!_wake_pending) {
+                _wake_pending = true;
+                wake = true;
+            }
+        }
+        if (wake) this->wakeup();
+        return ;
+    }
+
+    void stop() override {
+        _stop.store(true, std::memory_order_release);
+        this->wakeup();
+        return ;
+    }
+
+    void run() override {
+        while (!_stop.load(std::memory_order_acquire)) {
+            if (this->run_once(-1) < 0) break;
+        }
+        _stop.store(false, std::memory_order_relaxed);
+        return ;
+    }
+
+    const char *name() const override {
+        return "io_uring";
+    }
+
+private:
+
+    static int sys_setup(unsigned entries, struct io_uring_params *p) {
+        return (int)::syscall(__NR_io_uring_setup, entries, p);
+    }
+
+    static int sys_enter(int fd, unsigned submit, unsigned wait, unsigned flags, const void *arg, size_t size) {
+        return (int)::syscall(__NR_io_uring_enter, fd, submit, wait, flags, arg, size);
+    }
+
+    static int sys_register(int fd, unsigned opcode, const void *arg, unsigned nr) {
+        return (int)::syscall(__NR_io_uring_register, fd, opcode, arg, nr);
+    }
+
+    [[noreturn]] static void fail(const char *what) {
+        throw std::system_error(errno, std::system_category(), std::string("uring_service: ") + what);
+    }
+
+    /*************************************************************************
+    * > class uring_service
+    * > name : setup
+    * > Describe: : create the ring and map its queues
+     ************************************************************************/
+    void setup(unsigned entries) {
+        struct io_uring_params p = {};
+        p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN;
+        p.cq_entries = entries * 4;
+        _ring_fd = sys_setup(entries, &p);
+        if (_ring_fd < 0 && errno == EINVAL) {
+            // COOP_TASKRUN needs 5.19, it only saves interrupts
+            p = {};
+            p.flags = IORING_SETUP_CQSIZE;
+            p.cq_entries = entries * 4;
+            _ring_fd = sys_setup(entries, &p);
+        }
+        if (_ring_fd < 0) this->fail("io_uring_setup");
+        _sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        _cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+        bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single) _sq_size = _cq_size = std::max(_sq_size, _cq_size);
+        _sq_ptr = ::mmap(nullptr, _sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring_fd, IORING_OFF_SQ_RING);
+        if (_sq_ptr == MAP_FAILED) {
+            _sq_ptr = nullptr;
+            this->fail("mmap sq");
+        }
+        if (single) {
+            _cq_ptr = _sq_ptr;
+        } else {
+            _cq_ptr = ::mmap(nullptr, _cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring_fd, IORING_OFF_CQ_RING);
+            if (_cq_ptr == MAP_FAILED) {
+                _cq_ptr = nullptr;
+                this->fail("mmap cq");
+            }
+        }
+        _sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+        void *sqes = ::mmap(nullptr, _sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring_fd, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED) this->fail("mmap sqes");
+        _sqes = static_cast<struct io_uring_sqe *>(sqes);
+        char *sq = static_cast<char *>(_sq_ptr);
+        char *cq = static_cast<char *>(_cq_ptr);
+        _sq_head = reinterpret_cast<unsigned *>(sq + p.sq_off.head);
+        _sq_tail = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+        _sq_mask = *reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+        _sq_entries = p.sq_entries;
+        unsigned *array = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+        for (unsigned i = 0; i < p.sq_entries; ++i) array[i] = i;
+        _cq_head = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+        _cq_tail = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+        _cq_mask = *reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+        _cqes = reinterpret_cast<struct io_uring_cqe *>(cq + p.cq_off.cqes);
+        _sq_local = *_sq_tail;
+        _ext_arg = (p.features & IORING_FEAT_EXT_ARG) != 0;
+        return ;
+    }
+
+    /*************************************************************************
+    * > class uring_service
+    * > name : setup_buffers
+    * > Describe: : register the provided buffer ring used by recv()
+     ************************************************************************/
+    void setup_buffers() {
+        _br_size = _nbuf * sizeof(struct io_uring_buf);
+        void *ring = ::mmap(nullptr, _br_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ring == MAP_FAILED) this->fail("mmap buffer ring");
+        _br = static_cast<struct io_uring_buf_ring *>(ring);
+        _buffers = static_cast<char *>(::operator new((size_t)_nbuf * _buf_size));
+        struct io_uring_buf_reg reg = {};
+        reg.ring_addr = (uint64_t)(uintptr_t)_br;
+        reg.ring_entries = _nbuf;
+        reg.bgid = _group;
+        if (sys_register(_ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) this->fail("register buffer ring");
+        for (unsigned i = 0; i < _nbuf; ++i) this->put_buffer((uint16_t)i);
+        return ;
+    }
+
+    /*************************************************************************
+    * > class uring_service
+    * > name : put_buffer
+    * > Describe: : give buffer bid back to the kernel
+     ************************************************************************/
+    void put_buffer(uint16_t bid) {
+        // not _br->bufs: the flexible array member of the kernel header
+        // lands at offset 8 when compiled as C++, the ring starts at 0
+        uint16_t tail = _br->tail;
+        struct io_uring_buf &b = reinterpret_cast<struct io_uring_buf *>(_br)[tail & (_nbuf - 1)];
+        b.addr = (uint64_t)(uintptr_t)(_buffers + (size_t)bid * _buf_size);
+        b.len = _buf_size;
+        b.bid = bid;
+        __atomic_store_n(&_br->tail, (uint16_t)(tail + 1), __ATOMIC_RELEASE);
+        return ;
+    }
+
+    void teardown() {
+        if (_ring_fd >= 0) ::close(_ring_fd);
+        if (_wake_fd >= 0) ::close(_wake_fd);
+        if (_sqes != nullptr) ::munmap(_sqes, _sqes_size);
+        if (_cq_ptr != nullptr && _cq_ptr != _sq_ptr) ::munmap(_cq_ptr, _cq_size);
+        if (_sq_ptr != nullptr) ::munmap(_sq_ptr, _sq_size);
+        if (_br != nullptr) ::munmap(_br, _br_size);
+        ::operator delete(_buffers);
+        _ring_fd = _wake_fd = -1;
+        _sqes = nullptr;
+        _sq_ptr = _cq_ptr = nullptr;
+        _br = nullptr;
+        _buffers = nullptr;
+        return ;
+    }
+
+    /*************************************************************************
+    * > class uring_service
+    * > name : get_sqe
+    * > Describe: : next free submission entry, zeroed. A full queue is
+    *               handed to the kernel first, until it took some entries.
+     ************************************************************************/
+    struct io_uring_sqe *get_sqe() {
+        unsigned head = __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE);
+        while (_sq_local - head >= _sq_entries) {
+            if (this->enter(0) < 0) this->fail("io_uring_enter");
+            unsigned now = __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE);
+            if (now != head) break;
+            // the kernel refuses submissions while completions are backed up
+            this->park();
+        }
+        struct io_uring_sqe *sqe = &_sqes[_sq_local & _sq_mask];
+        std::memset(sqe, 0, sizeof(*sqe));
+        _sq_local += 1;
+        return sqe;
+    }
+
+    /*************************************************************************
+    * > class uring_service
+    * > name : enter
+    * > Describe: : submit what is queued and wait up to timeout_ms for at
+    *               least one completion, in one syscall
+     ************************************************************************/
+    int enter(int timeout_ms) {
+        __atomic_store_n(_sq_tail, _sq_local, __ATOMIC_RELEASE);
+        // entries the kernel has not consumed yet, including any left over
+        // by an earlier call that submitted short or failed with EBUSY
+        unsigned submit = _sq_local - __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE);
+        bool ready = !_parked.empty() || __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE) != *_cq_head;
+        unsigned wait = (timeout_ms == 0 || ready) ? 0 : 1;
+        if (submit == 0 && wait == 0) return 0;
+        unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+        struct __kernel_timespec ts = {};
+        struct io_uring_getevents_arg arg = {};
+        const void *argp = nullptr;
+        size_t argsz = 0;
+        if (wait && timeout_ms > 0 && _ext_arg) {
+            ts.tv_sec = timeout_ms / 1000;
+            ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+            arg.sigmask_sz = _NSIG / 8;
+            arg.ts = (uint64_t)(uintptr_t)&ts;
+            flags |= IORING_ENTER_EXT_ARG;
+            argp = &arg;
+            argsz = sizeof(arg);
+        }
+        for (;;) {
+            int ret = sys_enter(_ring_fd, submit, wait, flags, argp, argsz);
+            if (ret >= 0 || errno == ETIME) return 0;
+            if (errno == EINTR) {
+                submit = _sq_local - __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE);
+                continue;
+            }
+            // completions are backed up, reaping them frees the kernel
+            if (errno == EBUSY || errno == EAGAIN) return 0;
+            return -1;
+        }
+    }
+
+    /*************************************************************************
+    * > class uring_service
+    * > name : reap
+    * > Describe: : handle every completion available, then posted work
+     ************************************************************************/
+    int reap() {
+        int handled = 0;
+        bool woke = false;
+        for (;;) {
+            // parked completions are older than the ones still in the ring,
+            // and a callback may park more while this loop runs
+            struct io_uring_cqe cqe;
+            unsigned head = *_cq_head;
+            if (!_parked.empty()) {
+                cqe = _parked.front();
+                _parked.pop_front();
+            } else if (head != __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE)) {
+                cqe = _cqes[head & _cq_mask];
+                __atomic_store_n(_cq_head, head + 1, __ATOMIC_RELEASE);
+            } else {
+                break;
+            }
+            handled += 1;
+            if (cqe.user_data == _cancel_key) continue;
+            if (cqe.user_data == _wake_key) {
+                woke = true;
+                continue;
+            }
+            this->complete(reinterpret_cast<op_t *>((uintptr_t)cqe.user_data), cqe.res, cqe.flags);
+        }
+        if (woke) {
+            this->run_posted();
+            this->arm_wake();
+        }
+        return handled;
+    }
+
+    /*************************************************************************
+    * > class uring_service
+    * > name : park
+    * > Describe: : move the available completions out of the ring, and any
+    *               the kernel kept aside when it was full, for reap() to
+    *               handle later
+     ************************************************************************/
+    void park() {
+        if (sys_enter(_ring_fd, 0, 0, IORING_ENTER_GETEVENTS, nullptr, 0) < 0
+            && errno != EINTR && errno != EBUSY && errno != EAGAIN) {
+            this->fail("io_uring_enter");
+        }
+        unsigned head = *_cq_head;
+        while (head != __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE)) {
+            _parked.push_back(_cqes[head & _cq_mask]);
+            head += 1;
+        }
+        __atomic_store_n(_cq_head, head, __ATOMIC_RELEASE);
+        return ;
+    }
+
+    /*************************************************************************
+    * > class uring_service
+    * > name : complete
+    * > Describe: : one completion of op. Multishot operations stay armed
+    *               while IORING_CQE_F_MORE is set and are armed again when
+    *               the kernel ended them without an error.
+     ************************************************************************/
+    void complete(op_t *op, int res, uint32_t flags) {
+        bool more = (flags & IORING_CQE_F_MORE) != 0;
+        if (op->cancelled) {
+            // its callback already ran in cancel(), give back what came with it
+            if (op->kind == op_kind::accept && res >= 0) ::close(res);
+            if (op->kind == op_kind::recv && (flags & IORING_CQE_F_BUFFER)) {
+                this->put_buffer((uint16_t)(flags >> IORING_CQE_BUFFER_SHIFT));
+            }
+            if (!more) this->free_op(op);
+            return ;
+        }
+        switch (op->kind) {
+        case op_kind::accept:
+            if (res >= 0) op->on_accept(res);
+            if (more) return ;
+            if (res >= 0) {
+                this->submit_op(op);
+                return ;
+            }
+            this->finish_accept(op, res);
+            return ;
+        case op_kind::recv:
+            if (flags & IORING_CQE_F_BUFFER) {
+                uint16_t bid = (uint16_t)(flags >> IORING_CQE_BUFFER_SHIFT);
+                if (res > 0) op->on_recv(_buffers + (size_t)bid * _buf_size, res);
+                this->put_buffer(bid);
+            }
+            if (more) return ;
+            if (res > 0 || res == -ENOBUFS) {
+                // out of buffers or ended by the kernel, they are back now
+                this->submit_op(op);
+                return ;
+            }
+            this->finish_recv(op, res);
+            return ;
+        case op_kind::send:
+            if (res > 0) op->done += (size_t)res;
+            if (res > 0 && op->done < op->len) {
+                this->submit_op(op);
+                return ;
+            }
+            this->finish_send(op, res < 0 ? res : (ssize_t)op->len);
+            return ;
+        case op_kind::connect:
+            this->finish_connect(op, res);
+            return ;
+        }
+        return ;
+    }
+
+    void finish_accept(op_t *op, int res) {
+        _fds[op->fd].accept = nullptr;
+        accept_cb cb = std::move(op->on_accept);
+        this->free_op(op);
+        cb(res);
+        return ;
+    }
+
+    void finish_recv(op_t *op, int res) {
+        _fds[op->fd].recv = nullptr;
+        recv_cb cb = std::move(op->on_recv);
+        this->free_op(op);
+        cb(nullptr, res);
+        return ;
+    }
+
+    void finish_connect(op_t *op, int res) {
+        _fds[op->fd].connect = nullptr;
+        connect_cb cb = std::move(op->on_connect);
+        this->free_op(op);
+        cb(res);
+        return ;
+    }
+
+    /*************************************************************************
+    * > class uring_service
+    * > name : finish_send
+    * > Describe: : end the send in flight on its fd and start the next one
+     ************************************************************************/
+    void finish_send(op_t *op, ssize_t res) {
+        std::deque<op_t *> &sends = _fds[op->fd].sends;
+        sends.pop_front();
+        if (!sends.empty()) this->submit_op(sends.front());
+        send_cb cb = std::move(op->on_send);
+        this->free_op(op);
+        cb(res);
+        return ;
+    }
+
+    /*************************************************************************
+    * > class uring_service
+    * > name : submit_op
+    * > Describe: : queue the submission entry of op
+     ************************************************************************/
+    void submit_op(op_t *op) {
+        struct io_uring_sqe *sqe = this->get_sqe();
+        sqe->fd = op->fd;
+        sqe->user_data = (uint64_t)(uintptr_t)op;
+        switch (op->kind) {
+        case op_kind::accept:
+            sqe->opcode = IORING_OP_ACCEPT;
+            sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+            sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+            break;
+        case op_kind::recv:
+            sqe->opcode = IORING_OP_RECV;
+            sqe->ioprio = IORING_RECV_MULTISHOT;
+            sqe->flags = IOSQE_BUFFER_SELECT;
+            sqe->buf_group = _group;
+            break;
+        case op_kind::send:
+            sqe->opcode = IORING_OP_SEND;
+            sqe->addr = (uint64_t)(uintptr_t)(op->buf + op->done);
+            sqe->len = (uint32_t)std::min<size_t>(op->len - op->done, UINT32_MAX);
+            sqe->msg_flags = MSG_NOSIGNAL;
+            break;
+        case op_kind::connect:
+            sqe->opcode = IORING_OP_CONNECT;
+            sqe->addr = (uint64_t)(uintptr_t)&op->addr;
+            sqe->off = op->addr_len;
+            break;
+        }
+        return ;
+    }
+
+    /*************************************************************************
+    * > class uring_service
+    * > name : arm_wake
+    * > Describe: : read the eventfd, completing when post() or stop() write
+     ************************************************************************/
+    void arm_wake() {
+        struct io_uring_sqe *sqe = this->get_sqe();
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = _wake_fd;
+        sqe->addr = (uint64_t)(uintptr_t)&_wake_value;
+        sqe->len = sizeof(_wake_value);
+        sqe->user_data = _wake_key;
+        return ;
+    }
+
+    void wakeup() {
+        uint64_t one = 1;
+        ssize_t ret = ::write(_wake_fd, &one, sizeof(one));
+        (void)ret;
+        return ;
+    }
+
+    void run_posted() {
+        std::vector<std::function<void()>> posted;
+        {
+            std::unique_lock<std::mutex> locker(m_mutex);
+            posted.swap(_posted);
+            _wake_pending = false;
+        }
+        for (auto &fn : posted) fn();
+        return ;
+    }
+
+    /*************************************************************************
+    * > class uring_service
+    * > name : new_op
+    * > Describe: : op from the free list, ops are never freed before the
+    *               service so the kernel may hold their addresses
+     ************************************************************************/
+    op_t *new_op(op_kind kind, int fd) {
+        op_t *op = _free_ops;
+        if (op != nullptr) {
+            _free_ops = op->next_free;
+        } else {
+            _ops.emplace_back();
+            op = &_ops.back();
+        }
+        op->kind = kind;
+        op->fd = fd;
+        op->cancelled = false;
+        op->buf = nullptr;
+        op->len = 0;
+        op->done = 0;
+        op->addr_len = 0;
+        op->next_free = nullptr;
+        return op;
+    }
+
+    void free_op(op_t *op) {
+        op->on_accept = nullptr;
+        op->on_recv = nullptr;
+        op->on_send = nullptr;
+        op->on_connect = nullptr;
+        op->next_free = _free_ops;
+        _free_ops = op;
+        return ;
+    }
+
+    int _ring_fd;                                           // io_uring instance
+    int _wake_fd;                                           // eventfd for post() and stop()
+    void *_sq_ptr;                                          // submission ring mapping
+    void *_cq_ptr;                                          // completion ring mapping, may equal _sq_ptr
+    struct io_uring_sqe *_sqes;                             // submission entries
+    size_t _sq_size;                                        // mapping sizes
+    size_t _cq_size;
+    size_t _sqes_size;
+    unsigned *_sq_head;                                     // consumed by the kernel
+    unsigned *_sq_tail;                                     // published to the kernel
+    unsigned _sq_mask;
+    unsigned _sq_entries;
+    unsigned _sq_local;                                     // tail including entries not published yet
+    unsigned *_cq_head;                                     // consumed by us
+    unsigned *_cq_tail;                                     // produced by the kernel
+    unsigned _cq_mask;
+    struct io_uring_cqe *_cqes;                             // completion entries
+    std::deque<struct io_uring_cqe> _parked;                // taken out of the ring by get_sqe(), not handled yet
+    bool _ext_arg;                                          // io_uring_enter takes a timeout
+    struct io_uring_buf_ring *_br;                          // provided buffer ring
+    size_t _br_size;
+    char *_buffers;                                         // _nbuf buffers of _buf_size bytes
+    unsigned _nbuf;
+    unsigned _buf_size;
+    std::deque<op_t> _ops;                                  // every op ever made, stable addresses
+    op_t *_free_ops;                                        // free list of _ops
+    std::unordered_map<int, fd_ops_t> _fds;                 // operations in flight per fd
+    std::mutex m_mutex;                                     // mutex for _posted
+    std::vector<std::function<void()>> _posted;             // work for the service thread
+    std::atomic<bool> _stop;                                // set by stop()
+    bool _wake_pending;                                     // eventfd written since the last round
+    uint64_t _wake_value;                                   // target of the eventfd read
+};
+
+/*************************************************************************
+* > Enum Name: io_backend
+* > Describe: implementation chosen by make_io_service()
+ ************************************************************************/
+enum class io_backend {
+    epoll,                                                  // epoll_service
+    uring,                                                  // uring_service, throws when unavailable
+    best                                                    // uring_service, epoll_service when unavailable
+};
+
+/*************************************************************************
+* > Function Name: make_io_service
+* > Describe: create the io_service of backend
+ ************************************************************************/
+inline std::unique_ptr<io_service> make_io_service(io_backend backend, thread_pool *pool = nullptr,
+                                                   const uring_options &options = uring_options()) {
+    if (backend == io_backend::epoll) return std::unique_ptr<io_service>(new epoll_service(pool));
+    if (backend == io_backend::uring) return std::unique_ptr<io_service>(new uring_service(pool, options));
+    try {
+        return std::unique_ptr<io_service>(new uring_service(pool, options));
+    } catch (const std::system_error &) {
+        return std::unique_ptr<io_service>(new epoll_service(pool));
+    }
+}
+
+__NAMESPACE_Cgo_END__
+
+// DATE: 2024-08-03
+// FILENAME: uring.h
+// AUTHOR: royi
+// END:
+
+#endif